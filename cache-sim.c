@@ -1,7 +1,10 @@
 //written by: Jeremy Keys 
 //Last modified: 4-13-17
 
+#define _POSIX_C_SOURCE 200809L	//clock_gettime, pthreads
+
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -9,6 +12,97 @@
 #include <time.h>
 #include <math.h>
 
+#include "coherence-log.h"
+
+/****************** optional self-profiling (build with -DPROFILE, e.g. make profile) ******************/
+
+//only every PROFILE_SAMPLE_INTERVAL-th access is timed; stage totals are scaled up from the sampled accesses
+#ifdef PROFILE
+
+#ifndef PROFILE_SAMPLE_INTERVAL
+#define PROFILE_SAMPLE_INTERVAL 64
+#endif
+
+enum { PROF_PARSE, PROF_LOOKUP, PROF_SNOOP, PROF_LRU, PROF_OTHER, NUM_PROF_STAGES };
+
+const char *PROF_STAGE_NAMES[] = { "trace parsing", "tag lookup/victim selection", "coherence snooping", "LRU updates", "bookkeeping/debug output" };
+
+typedef struct Profile {
+	unsigned long long stageNanos[NUM_PROF_STAGES];	//sampled accesses only
+	unsigned long long stageSamples[NUM_PROF_STAGES];
+	unsigned long long timerNanos;	//cost of one timestamp, taken out of every sample
+	unsigned long long numAccesses, numSampled, numSnoopIterations;
+	unsigned long long runStart, runNanos;
+	int sampling;	//whether the current access is being timed
+} Profile;
+
+Profile prof;
+
+unsigned long long profNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void profStart() {
+	unsigned long long start = profNow();
+	for(int i = 0; i != 1000; i++) profNow();
+	prof.timerNanos = (profNow() - start) / 1001;
+	prof.runStart = profNow();
+}
+
+double profStageSeconds(int stage, double scale) {
+	double nanos = (double) prof.stageNanos[stage] - (double) (prof.stageSamples[stage] * prof.timerNanos);
+	return nanos > 0 ? nanos * scale / 1e9 : 0.0;
+}
+
+void printProfile() {
+	double scale = prof.numSampled ? (double) prof.numAccesses / (double) prof.numSampled : 0.0;
+	double seconds = prof.runNanos / 1e9;
+	double stageSum = 0.0;
+	long long otherNanos = (long long) prof.stageNanos[PROF_OTHER];
+	
+	//the whole access was timed as PROF_OTHER, so take out the stages (and their timestamps) timed inside it;
+	//timer jitter can make the nested samples add up to more than the outer one
+	for(int i = PROF_LOOKUP; i != PROF_OTHER; i++) {
+		otherNanos -= (long long) (prof.stageNanos[i] + prof.stageSamples[i] * prof.timerNanos);
+	}
+	prof.stageNanos[PROF_OTHER] = otherNanos > 0 ? (unsigned long long) otherNanos : 0;
+	
+	printf("Simulator profile (1 in %d accesses sampled):\n", PROFILE_SAMPLE_INTERVAL);
+	printf("Total number of accesses simulated: %llu\n", prof.numAccesses);
+	printf("Total simulation time: %f s (%f accesses/sec)\n", seconds, seconds > 0 ? prof.numAccesses / seconds : 0.0);
+	//the stages are extrapolated from samples, so shares are of whichever is larger: their sum or the measured run
+	double totalSeconds = seconds;
+	for(int i = 0; i != NUM_PROF_STAGES; i++) stageSum += profStageSeconds(i, scale);
+	if(stageSum > totalSeconds) totalSeconds = stageSum;
+	for(int i = 0; i != NUM_PROF_STAGES; i++) {
+		double stageSeconds = profStageSeconds(i, scale);
+		printf("  %-28s %f s (%5.1f%%)\n", PROF_STAGE_NAMES[i], stageSeconds, totalSeconds > 0 ? 100.0 * stageSeconds / totalSeconds : 0.0);
+	}
+	printf("Snoop loop iterations per access: %f\n\n", prof.numAccesses ? (double) prof.numSnoopIterations / prof.numAccesses : 0.0);
+}
+
+#define PROF_RUN_START()		profStart()
+#define PROF_RUN_STOP()			(prof.runNanos = profNow() - prof.runStart)
+#define PROF_BEGIN_ACCESS()		(prof.sampling = (prof.numAccesses++ % PROFILE_SAMPLE_INTERVAL) == 0, prof.numSampled += prof.sampling)
+#define PROF_START(t)			unsigned long long t = prof.sampling ? profNow() : 0
+#define PROF_STOP(stage, t)		if(prof.sampling) prof.stageNanos[stage] += profNow() - (t), prof.stageSamples[stage]++
+#define PROF_COUNT_SNOOP()		(prof.numSnoopIterations++)
+#define PROF_REPORT()			printProfile()
+
+#else
+
+#define PROF_RUN_START()
+#define PROF_RUN_STOP()
+#define PROF_BEGIN_ACCESS()
+#define PROF_START(t)
+#define PROF_STOP(stage, t)
+#define PROF_COUNT_SNOOP()
+#define PROF_REPORT()
+
+#endif
+
 /****************** useful constants/magic numbers ******************/
 
 const int ADDRESS_LENGTH     = 32;
@@ -18,11 +112,49 @@ const int NUM_BITS_PER_LRU   = 2;
 const int NUM_BITS_PER_VALID = 1;
 const int NUM_BITS_PER_DIRTY = 1;
 const int NUM_CYCLES_PER_HIT = 1;
+const int NUM_CYCLES_PER_VICTIM_HIT = 1;
+
+//NUMA latencies used when the topology file does not give them (misses default to -m locally, twice that remotely)
+const int DEFAULT_LOCAL_INVAL_CYCLES  = 20;
+const int DEFAULT_REMOTE_INVAL_CYCLES = 80;
+const int DEFAULT_LOCAL_C2C_CYCLES    = 40;
+const int DEFAULT_REMOTE_C2C_CYCLES   = 120;
+const int DEFAULT_INTERLEAVE_BYTES    = 4096;
+
+//address translation latencies (a first-level TLB hit is overlapped with the cache access)
+const int NUM_CYCLES_PER_TLB2_HIT   = 7;
+const int NUM_CYCLES_PER_WALK_STEP  = 30;	//one page table level read during a page walk
+const int NUM_BITS_PER_PAGE_LEVEL   = 9;	//x86-64 style radix page table
+
+//DRAM timing defaults, in core cycles (-dram prices memory fetches with these instead of the flat -m penalty)
+const int DEFAULT_DRAM_ROW_HIT_CYCLES      = 40;	//column access to the open row
+const int DEFAULT_DRAM_ROW_MISS_CYCLES     = 80;	//activate + column access on a precharged bank
+const int DEFAULT_DRAM_ROW_CONFLICT_CYCLES = 120;	//precharge + activate + column access
+const int DRAM_ROW_BYTES           = 8192;
+const int DRAM_BYTES_PER_BUS_CYCLE = 16;
+const int DRAM_QUEUE_ENTRIES       = 32;
+
+const unsigned int H3_SEED = 0x9e3779b9;	//same hash matrices in every cache and run
+const int H3_TABLE_SIZE = 4 * 256;			//one 256-entry table per tag byte
 
 unsigned int NUM_CORES = 2;
 
 const char WRITE_BACK = 'B';
 const char WRITE_THRU = 'T';
+const char WRITE_ALLOCATE    = 'A';
+const char NO_WRITE_ALLOCATE = 'N';
+const char VICTIM_CACHE = 'V';
+const char MISS_CACHE   = 'M';
+const char OPEN_PAGE    = 'O';
+const char CLOSED_PAGE  = 'C';
+const char MERGE_TIMESTAMP   = 'T';
+const char MERGE_ROUND_ROBIN = 'R';
+const char MERGE_RANDOM      = 'S';
+const char INDEX_MODULO   = 'M';
+const char INDEX_XOR_FOLD = 'X';
+const char INDEX_PRIME    = 'P';
+const char INDEX_H3       = 'H';
+const char INDEX_SKEWED   = 'S';	//H3 with a different hash per way
 const char WRITE_OP   = 'W';
 const char READ_OP    = 'R';
 const char MODIFIED   = 'M';
@@ -31,6 +163,16 @@ const char SHARED     = 'S';
 
 int debug = 0;
 
+const int EVENT_LOG_BUFFER_EVENTS = 65536;
+
+//reduced trace record types
+const char RED_READ       = 'R';	//read miss, block fetched
+const char RED_WRITE      = 'W';	//write miss, block fetched for ownership
+const char RED_UPGRADE    = 'U';	//write to a shared block, other copies invalidated
+const char RED_WRITE_THRU = 'T';	//store written to memory (write-through or written around the cache)
+const char RED_WRITEBACK  = 'B';	//modified/dirty block written to memory
+const char REDUCED_TRACE_MAGIC[8] = "CSIMRED1";
+
 /****************** Useful OO structures ******************/
 
 typedef struct Entry Entry;
@@ -57,6 +199,8 @@ typedef struct Entry {
 	//A7 additions
 	char state; //MODIFIED, SHARED or INVALID
 	int entryID;
+	
+	unsigned int address;	//first byte of the block held, for writebacks (the tag and set do not always give it back)
 } Entry;
 
 typedef struct Set {
@@ -68,6 +212,18 @@ typedef struct Set {
 	int setID;
 } Set;
 
+//FIFO of pending block writes to memory; stores to a block already in the buffer are coalesced
+typedef struct WriteBuffer {
+	unsigned int *blocks;		//block numbers, oldest at head
+	unsigned int *wordMasks;	//words of each block written while buffered
+	char *writebacks;		//1 if the entry only holds a dirty block written back on eviction
+	unsigned int numEntries, numEntriesInUse, head;
+	unsigned int nextDrainCycle;	//cycle at which the oldest entry finishes its write to memory
+	unsigned int numInserts, numCoalesced, numDrains, numFullBlockDrains;
+	unsigned int numStalls, numStallCycles, maxOccupancy;
+	unsigned long long occupancySum;
+} WriteBuffer;
+
 typedef struct Cache {
 	unsigned int blockSize;		//blockSize in number of bytes 
 	unsigned int numDataWords, numBytes;
@@ -94,14 +250,185 @@ typedef struct Cache {
 	unsigned int numBlocksInvalidated, numWriteBacksDueToAccessNeed,numWriteBacksDueToReadMiss, NumWritesToCacheDueToWriteOp, NumWritesBacksDueToWriteThruPolicy;
 	unsigned int numWritesToCacheDueToReadMiss;
 	unsigned int cacheID;
+	
+	//write allocation and buffering
+	char writeAllocPolicy;
+	unsigned int numWritesAroundCache;
+	WriteBuffer writeBuffer;		//stores headed to memory
+	WriteBuffer writeCombineBuffer;	//streaming (non-allocating) stores
+	
+	//small fully-associative victim cache (or miss cache) shared by all sets
+	Set victimCache;
+	char victimCachePolicy;		//VICTIM_CACHE or MISS_CACHE
+	unsigned int numVictimHits, numVictimSwaps, numVictimEvictions, numVictimWriteBacks, numVictimInvalidations;
+	
+	//address translation (the page walk cache holds upper-level page table entries)
+	Set tlb, tlb2, pageWalkCache;
+	unsigned int numTlbHits, numTlb2Hits, numPageWalks, numPageWalkSteps, numPageWalkCacheHits, numTlbCycles;
+	
+	//NUMA placement and traffic
+	int socketID;
+	unsigned int numLocalMisses, numRemoteMisses, numLocalInvalidations, numRemoteInvalidations;
+	unsigned int numLocalTransfers, numRemoteTransfers, numNumaCycles;
+	
+	//blocks fetched through the DRAM model and the cycles spent waiting for them
+	unsigned int numDramReads, numDramCycles;
+	
+	//set index function; prime-modulo and skewed caches store wider tags (see hashSetIndex)
+	char indexFunction;
+	unsigned int indexPrime;		//sets used by prime-modulo indexing
+	unsigned int *h3Tables;			//H3 hash tables, one group per way in a skewed cache
+	int replaceWay;					//way a skewed cache replaces on a miss
+	
+	//trace reduction
+	unsigned int numWriteAroundMisses;	//write misses that went around the cache, so nothing was fetched
 } Cache;
 
+//memory address range [start, end] whose home is socket node
+typedef struct MemRange {
+	unsigned int start, end;
+	int node;
+} MemRange;
+
+typedef struct Topology {
+	int numSockets;			//0 if no topology given (all caches equidistant on one bus)
+	int *coreSockets;		//socket of each core
+	MemRange *ranges;
+	int numRanges;
+	unsigned int interleaveBytes;	//addresses outside all ranges are interleaved across sockets at this granularity
+	unsigned int localMissCycles, remoteMissCycles;
+	unsigned int localInvalCycles, remoteInvalCycles;
+	unsigned int localC2CCycles, remoteC2CCycles;
+} Topology;
+
+typedef struct TlbConfig {
+	unsigned int numEntries;		//first-level TLB entries per core; 0 disables address translation
+	unsigned int numL2Entries;		//second-level TLB entries per core; 0 if none
+	unsigned int numWalkCacheEntries;
+	unsigned int pageShift;			//12, 21 or 30 (4K, 2M or 1G pages)
+	int physical;					//index caches with synthetic physical addresses instead of virtual ones
+} TlbConfig;
+
+typedef struct DramConfig {
+	char pagePolicy;			//OPEN_PAGE or CLOSED_PAGE; 0 disables the DRAM model
+	unsigned int numChannels, numRanks, numBanks;	//numBanks is per rank
+	unsigned int rowHitCycles, rowMissCycles, rowConflictCycles;
+} DramConfig;
+
+//how per-core traces are interleaved into one access stream
+typedef struct MergeConfig {
+	char policy;			//MERGE_TIMESTAMP, MERGE_ROUND_ROBIN or MERGE_RANDOM
+	unsigned int quantum;	//accesses a core issues per turn (round-robin and random)
+	unsigned int seed;
+} MergeConfig;
+
+//first-touch mapping of virtual pages to synthetic physical frames, shared by all cores (one process)
+typedef struct PageTable {
+	unsigned int *vpns, *pfns;
+	char *used;
+	unsigned int capacity, numPages;
+} PageTable;
+
 typedef struct MulticoreCache {
 	Cache *caches;
 	
 	int numCores; //== numCaches
+	
+	Topology topology;
+	unsigned long long numAccesses;	//trace lines simulated so far
+	
+	TlbConfig tlbConfig;
+	PageTable pageTable;
 } MulticoreCache;
 
+//double-buffered binary event log; full buffers are written to disk by a separate thread
+typedef struct EventLog {
+	FILE *file;				//NULL when logging is disabled
+	CoherenceEvent *buffers[2];
+	int fillBuffer;			//buffer the simulator is filling
+	unsigned int numFilled;
+	CoherenceEvent *pending;	//buffer handed to the writer thread, NULL once written
+	unsigned int numPending;
+	int done;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long long accessIndex, numEvents;
+} EventLog;
+
+EventLog eventLog = {0};
+
+//binary trace of the requests leaving the caches (misses, upgrades, writes to memory)
+typedef struct ReducedTraceHeader {
+	char magic[8];
+	uint32_t recordSize, numCores, blockBytes, reserved;
+	uint64_t numAccesses;	//accesses in the original trace
+	uint64_t numRecords;
+} ReducedTraceHeader;
+
+typedef struct ReducedRecord {
+	uint32_t address;	//block address
+	uint8_t core;
+	char type;			//RED_READ, RED_WRITE, RED_UPGRADE, RED_WRITE_THRU or RED_WRITEBACK
+	uint16_t reserved;
+} ReducedRecord;
+
+typedef struct ReducedTrace {
+	FILE *file;			//NULL when not reducing
+	ReducedTraceHeader header;
+} ReducedTrace;
+
+ReducedTrace reducedTrace = {0};
+
+typedef struct DramBank {
+	int rowOpen;
+	unsigned int openRow;
+	unsigned int readyCycle;	//cycle the bank can take its next command
+} DramBank;
+
+typedef struct DramRequest {
+	unsigned int arrival;	//memory controller cycle the request reached it
+	unsigned int channel, bank, row;	//bank indexes all banks of all channels and ranks
+	int isWrite;
+} DramRequest;
+
+//memory controller shared by all caches; reads are issued as they arrive, writes wait in the FR-FCFS queue
+typedef struct Dram {
+	DramConfig config;
+	unsigned int blockBytes, rowBlocks, burstCycles;
+	DramBank *banks;
+	unsigned int *busReadyCycles;	//per channel
+	DramRequest *queue;				//in arrival order
+	unsigned int numQueued, maxQueued;
+	unsigned int numReads, numWrites, numRowHits, numRowMisses, numRowConflicts;
+	unsigned int clock;		//latest core cycle seen; cores run their own clocks, so requests arrive on this one
+	unsigned int firstArrival, lastDone;
+	unsigned long long queueDelaySum, readLatencySum, busBusyCycles;
+} Dram;
+
+Dram dram = {0};
+
+//one per-core trace and its next access
+typedef struct TraceStream {
+	FILE *file;
+	unsigned int coreID, address;
+	char mode;
+	unsigned long long timestamp;	//from the trace, or the access's position in it if untimed
+	unsigned long long numAccesses;	//read so far, including the pending one
+	unsigned long long key;			//merge order, ties going to the lower core
+} TraceStream;
+
+//streaming k-way merge; the heap holds the streams with accesses left, smallest key on top
+typedef struct TraceMerge {
+	MergeConfig config;
+	TraceStream *streams;
+	TraceStream **heap;
+	int numStreams, heapSize;
+	unsigned long long clock;		//key of the last access merged
+	unsigned long long randomState;
+	unsigned long long numAccesses;
+} TraceMerge;
+
 
 /****************** print functions ******************/
 
@@ -125,6 +452,58 @@ void printSet(Set *s, int n) {
 	printf("\n");
 }	
 
+void printWriteBufferStats(Cache *c, WriteBuffer *wb, const char *name) {
+	printf("Number of %s entries: %u\n", name, wb->numEntries);
+	printf("Total number of stores entering %s: %u\n", name, wb->numInserts + wb->numCoalesced);
+	printf("Total number of stores coalesced in %s: %u\n", name, wb->numCoalesced);
+	printf("Total number of %s blocks written to mem: %u\n", name, wb->numDrains);
+	printf("Total number of %s blocks written to mem as full blocks: %u\n", name, wb->numFullBlockDrains);
+	printf("Average %s occupancy: %f entries (max %u)\n", name, c->numInstructions ? (double) wb->occupancySum / c->numInstructions : 0.0, wb->maxOccupancy);
+	printf("Total number of stalls on full %s: %u (%u cycles)\n", name, wb->numStalls, wb->numStallCycles);
+}
+
+void printVictimCacheStats(Cache *c) {
+	const char *name = c->victimCachePolicy == VICTIM_CACHE ? "victim cache" : "miss cache";
+	
+	printf("Number of %s entries: %u\n", name, c->victimCache.numEntries);
+	printf("Total number of %s hits: %u\n", name, c->numVictimHits);
+	if(c->victimCachePolicy == VICTIM_CACHE) {
+		printf("Total number of %s swaps: %u\n", name, c->numVictimSwaps);
+		printf("Total number of blocks evicted into %s: %u\n", name, c->numVictimEvictions);
+	}
+	printf("Total number of writes to mem due to %s replacement: %u\n", name, c->numVictimWriteBacks);
+	printf("Total number of %s blocks invalidated by other caches: %u\n", name, c->numVictimInvalidations);
+}
+
+void printTlbStats(Cache *c) {
+	unsigned int numTranslations = c->numTlbHits + c->numTlb2Hits + c->numPageWalks;
+	
+	printf("Total number of TLB hits: %u\n", c->numTlbHits);
+	if(c->tlb2.numEntries) printf("Total number of second-level TLB hits: %u\n", c->numTlb2Hits);
+	printf("Total number of TLB misses (page walks): %u\n", c->numPageWalks);
+	printf("Total number of page table levels read by page walks: %u\n", c->numPageWalkSteps);
+	if(c->pageWalkCache.numEntries) printf("Total number of page walk cache hits: %u\n", c->numPageWalkCacheHits);
+	printf("TLB miss ratio: %f\n", numTranslations ? (double) c->numPageWalks / numTranslations : 0.0);
+	printf("Total number of cycles spent on address translation: %u\n", c->numTlbCycles);
+}
+
+void printNumaStats(Cache *c) {
+	printf("Socket: %d\n", c->socketID);
+	printf("Total number of misses to local memory: %u\n", c->numLocalMisses);
+	printf("Total number of misses to remote memory: %u\n", c->numRemoteMisses);
+	printf("Total number of invalidations sent to caches on the local socket: %u\n", c->numLocalInvalidations);
+	printf("Total number of invalidations sent to caches on remote sockets: %u\n", c->numRemoteInvalidations);
+	printf("Total number of cache-to-cache transfers from the local socket: %u\n", c->numLocalTransfers);
+	printf("Total number of cache-to-cache transfers from remote sockets: %u\n", c->numRemoteTransfers);
+	printf("Total number of cycles spent on misses, invalidations and transfers: %u\n", c->numNumaCycles);
+}
+
+void printDramStats(Cache *c) {
+	printf("Total number of blocks fetched from DRAM: %u\n", c->numDramReads);
+	printf("Total number of cycles spent waiting on DRAM: %u\n", c->numDramCycles);
+	printf("Average DRAM fetch latency: %f cycles\n", c->numDramReads ? (double) c->numDramCycles / c->numDramReads : 0.0);
+}
+
 void printCacheStatsHelper(Cache *c) {
 	printf("Cache ID: %d\n", c->cacheID);
 	printf("Total size of cache (data only) in bytes: %u\n", 	c->numDataWords*NUM_BYTES_PER_WORD);
@@ -144,6 +523,7 @@ void printCacheStatsHelper(Cache *c) {
 	printf("Total number of writes to mem due to another cache invalidating and then modifying shared block: %u\n",c->numBlocksInvalidated);
 	if(c->writePolicy == WRITE_BACK) printf("Total number of writes to mem due to a read miss on a dirty block: %u\n",c->numWriteBacksDueToReadMiss);
 	if(c->writePolicy == WRITE_THRU) printf("Total number of writes to mem due to cache write w/ write-through policy: %u\n",c->NumWritesBacksDueToWriteThruPolicy);
+	if(c->writePolicy == WRITE_BACK && c->writeAllocPolicy == NO_WRITE_ALLOCATE) printf("Total number of writes to mem due to write misses w/ no-write-allocate policy: %u\n",c->numWritesAroundCache);
 	
 	printf("Total number of writes to cache: %u\n", 			c->numWritesToCache);
 	printf("Total number of writes to cache due to read misses(read from mem, write to cache): %u\n",c->numWritesToCacheDueToReadMiss);
@@ -151,12 +531,80 @@ void printCacheStatsHelper(Cache *c) {
 	printf("Hit ratio: %f\n", 							c->hitRatio);
 	
 	printf("Average memory access time: %f cycles\n", 	c->avgMemAccessTime); //TODO: need cast to float?
+	
+	if(c->writeBuffer.numEntries) printWriteBufferStats(c, &c->writeBuffer, "write buffer");
+	if(c->writeCombineBuffer.numEntries) printWriteBufferStats(c, &c->writeCombineBuffer, "write-combining buffer");
+	if(c->victimCache.numEntries) printVictimCacheStats(c);
+}
+
+void printTopologyStats(MulticoreCache *mcc) {
+	Topology *t = &mcc->topology;
+	unsigned int local = 0, remote = 0, localCycles = 0, remoteCycles = 0;
+	Cache *c;
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		c = mcc->caches+i;
+		local += c->numLocalMisses + c->numLocalInvalidations + c->numLocalTransfers;
+		remote += c->numRemoteMisses + c->numRemoteInvalidations + c->numRemoteTransfers;
+		localCycles += c->numLocalMisses * t->localMissCycles + c->numLocalInvalidations * t->localInvalCycles + c->numLocalTransfers * t->localC2CCycles;
+		remoteCycles += c->numRemoteMisses * t->remoteMissCycles + c->numRemoteInvalidations * t->remoteInvalCycles + c->numRemoteTransfers * t->remoteC2CCycles;
+	}
+	
+	printf("Number of sockets: %d\n", t->numSockets);
+	printf("Total number of local socket messages (misses, invalidations, transfers): %u (%u cycles)\n", local, localCycles);
+	printf("Total number of remote socket messages (misses, invalidations, transfers): %u (%u cycles)\n", remote, remoteCycles);
+	printf("Fraction of coherence/memory cycles spent crossing sockets: %f\n", localCycles + remoteCycles ? (double) remoteCycles / (double) (localCycles + remoteCycles) : 0.0);
+}
+
+void printMemoryControllerStats(Dram *d) {
+	unsigned int numRequests = d->numReads + d->numWrites;
+	unsigned int span = numRequests ? d->lastDone - d->firstArrival : 0;
+	
+	printf("DRAM: %u channel(s), %u rank(s) per channel, %u banks per rank, %s-page policy\n", d->config.numChannels, d->config.numRanks, d->config.numBanks, d->config.pagePolicy == OPEN_PAGE ? "open" : "closed");
+	printf("Total number of DRAM reads: %u\n", d->numReads);
+	printf("Total number of DRAM writes: %u\n", d->numWrites);
+	printf("Total number of row hits: %u\n", d->numRowHits);
+	printf("Total number of row misses (bank precharged): %u\n", d->numRowMisses);
+	printf("Total number of row conflicts (other row open): %u\n", d->numRowConflicts);
+	printf("Row buffer hit ratio: %f\n", numRequests ? (double) d->numRowHits / numRequests : 0.0);
+	printf("Average DRAM read latency: %f cycles\n", d->numReads ? (double) d->readLatencySum / d->numReads : 0.0);
+	printf("Average DRAM queueing delay: %f cycles\n", numRequests ? (double) d->queueDelaySum / numRequests : 0.0);
+	printf("Maximum DRAM queue occupancy: %u of %d\n", d->maxQueued, DRAM_QUEUE_ENTRIES);
+	printf("DRAM bandwidth: %f bytes/cycle over %u cycles\n", span ? (double) numRequests * d->blockBytes / span : 0.0, span);
+	printf("DRAM data bus utilization: %f\n", span ? (double) d->busBusyCycles / ((double) span * d->config.numChannels) : 0.0);
+}
+
+void printIndexFunction(Cache *c) {
+	if(c->indexFunction == INDEX_XOR_FOLD) printf("Set index function: XOR-fold\n");
+	else if(c->indexFunction == INDEX_H3) printf("Set index function: H3 hash\n");
+	else if(c->indexFunction == INDEX_SKEWED) printf("Set index function: skewed-associative (H3 hash per way, %u ways)\n", c->numEntriesPerSet);
+	else printf("Set index function: prime-modulo (%u of %u sets used)\n", c->indexPrime, c->numSets);
 }
 
 void printCacheStats(MulticoreCache *mcc) {
 	printf("Number of cores: %d\n", NUM_CORES);
 	for(int i = 0; i != NUM_CORES; i++) {
 		printCacheStatsHelper(mcc->caches+i);
+		if(mcc->tlbConfig.numEntries) printTlbStats(mcc->caches+i);
+		if(mcc->topology.numSockets) printNumaStats(mcc->caches+i);
+		if(dram.config.pagePolicy) printDramStats(mcc->caches+i);
+		printf("\n");
+	}
+	if(mcc->topology.numSockets) {
+		printTopologyStats(mcc);
+		printf("\n");
+	}
+	if(mcc->tlbConfig.numEntries) {
+		printf("Page size: %u bytes\n", 1u << mcc->tlbConfig.pageShift);
+		printf("Total number of pages touched: %u\n", mcc->pageTable.numPages);
+		printf("Caches indexed by: %s address\n\n", mcc->tlbConfig.physical ? "physical" : "virtual");
+	}
+	if(mcc->caches->indexFunction != INDEX_MODULO) {
+		printIndexFunction(mcc->caches);
+		printf("\n");
+	}
+	if(dram.config.pagePolicy) {
+		printMemoryControllerStats(&dram);
 		printf("\n");
 	}
 	printf("\n");
@@ -171,7 +619,15 @@ int IsPowerOfTwo(int x)
     return (x != 0) && ((x & (x - 1)) == 0); //return 0 if not power
 }
 
-int processProgArgs(char** argv, int argc, int *blockSize, int *totalNumDataWords, int *numCyclesPerMiss, int *setAssociativity, char *writePolicy) {
+int isPrime(unsigned int x) {
+	if(x < 2) return 0;
+	for(unsigned int d = 2; d * d <= x; d++) {
+		if(x % d == 0) return 0;
+	}
+	return 1;
+}
+
+int processProgArgs(char** argv, int argc, int *blockSize, int *totalNumDataWords, int *numCyclesPerMiss, int *setAssociativity, char *writePolicy, char *writeAllocPolicy, int *writeBufferSize, int *writeCombineSize, int *victimCacheSize, char *victimCachePolicy, char **topologyFile, char **eventLogFile, TlbConfig *tlbConfig, char **reducedTraceFile, DramConfig *dramConfig, MergeConfig *mergeConfig, char *indexFunction) {
 		
 	if(argc % 2 != 0) {
 		printf("Must provide an odd amount of arguments\n"); //will actually be even, b/c argv[0] is name of program
@@ -221,18 +677,265 @@ int processProgArgs(char** argv, int argc, int *blockSize, int *totalNumDataWord
 				return 9;
 			}	
 			NUM_CORES = flagValue;
+		} else if(strcmp(flag, "-wa") == 0) {
+			*writeAllocPolicy = flagValue_s[0];
+			if(*writeAllocPolicy != WRITE_ALLOCATE && *writeAllocPolicy != NO_WRITE_ALLOCATE) {
+				printf("Valid flags are 'A' (write-allocate) or 'N' (no-write-allocate)\n");
+				return 10;
+			}
+		} else if(strcmp(flag, "-wb") == 0) {
+			if(flagValue < 0) {
+				printf("Number of write buffer entries must not be negative\n");
+				return 11;
+			}
+			*writeBufferSize = flagValue;
+		} else if(strcmp(flag, "-wc") == 0) {
+			if(flagValue < 0) {
+				printf("Number of write-combining buffer entries must not be negative\n");
+				return 12;
+			}
+			*writeCombineSize = flagValue;
+		} else if(strcmp(flag, "-vc") == 0 || strcmp(flag, "-mc") == 0) {
+			if(flagValue < 0) {
+				printf("Number of victim/miss cache entries must not be negative\n");
+				return 13;
+			}
+			if(*victimCacheSize && *victimCachePolicy != flag[1]) {
+				printf("Only one of a victim cache (-vc) or a miss cache (-mc) may be enabled\n");
+				return 14;
+			}
+			*victimCacheSize = flagValue;
+			*victimCachePolicy = flag[1] == 'v' ? VICTIM_CACHE : MISS_CACHE;
+		} else if(strcmp(flag, "-topo") == 0) {
+			*topologyFile = flagValue_s;
+		} else if(strcmp(flag, "-log") == 0) {
+			*eventLogFile = flagValue_s;
+		} else if(strcmp(flag, "-tlb") == 0 || strcmp(flag, "-tlb2") == 0 || strcmp(flag, "-pwc") == 0) {
+			if(flagValue < 0) {
+				printf("Number of TLB and page walk cache entries must not be negative\n");
+				return 18;
+			}
+			if(flag[1] == 'p') tlbConfig->numWalkCacheEntries = flagValue;
+			else if(flag[4] == '2') tlbConfig->numL2Entries = flagValue;
+			else tlbConfig->numEntries = flagValue;
+		} else if(strcmp(flag, "-page") == 0) {
+			if(strcmp(flagValue_s, "4K") == 0) tlbConfig->pageShift = 12;
+			else if(strcmp(flagValue_s, "2M") == 0) tlbConfig->pageShift = 21;
+			else if(strcmp(flagValue_s, "1G") == 0) tlbConfig->pageShift = 30;
+			else {
+				printf("Valid page sizes are 4K, 2M or 1G\n");
+				return 19;
+			}
+		} else if(strcmp(flag, "-pa") == 0) {
+			tlbConfig->physical = flagValue != 0;
+		} else if(strcmp(flag, "-reduce") == 0) {
+			*reducedTraceFile = flagValue_s;
+		} else if(strcmp(flag, "-dram") == 0) {
+			dramConfig->pagePolicy = flagValue_s[0];
+			if(dramConfig->pagePolicy != OPEN_PAGE && dramConfig->pagePolicy != CLOSED_PAGE) {
+				printf("Valid DRAM page policies are 'O' (open-page) or 'C' (closed-page)\n");
+				return 21;
+			}
+		} else if(strcmp(flag, "-channels") == 0 || strcmp(flag, "-ranks") == 0 || strcmp(flag, "-banks") == 0
+			|| strcmp(flag, "-rowhit") == 0 || strcmp(flag, "-rowmiss") == 0 || strcmp(flag, "-rowconflict") == 0) {
+			if(flagValue <= 0) {
+				printf("Number of DRAM channels, ranks, banks and row access cycles must be positive\n");
+				return 22;
+			}
+			if(strcmp(flag, "-channels") == 0) dramConfig->numChannels = flagValue;
+			else if(strcmp(flag, "-ranks") == 0) dramConfig->numRanks = flagValue;
+			else if(strcmp(flag, "-banks") == 0) dramConfig->numBanks = flagValue;
+			else if(strcmp(flag, "-rowhit") == 0) dramConfig->rowHitCycles = flagValue;
+			else if(strcmp(flag, "-rowmiss") == 0) dramConfig->rowMissCycles = flagValue;
+			else dramConfig->rowConflictCycles = flagValue;
+		} else if(strcmp(flag, "-merge") == 0) {
+			mergeConfig->policy = flagValue_s[0];
+			if(mergeConfig->policy != MERGE_TIMESTAMP && mergeConfig->policy != MERGE_ROUND_ROBIN && mergeConfig->policy != MERGE_RANDOM) {
+				printf("Valid merge policies are 'T' (timestamp), 'R' (round-robin) or 'S' (seeded random)\n");
+				return 24;
+			}
+		} else if(strcmp(flag, "-quantum") == 0) {
+			if(flagValue <= 0) {
+				printf("Merge quantum must be positive\n");
+				return 25;
+			}
+			mergeConfig->quantum = flagValue;
+		} else if(strcmp(flag, "-seed") == 0) {
+			mergeConfig->seed = (unsigned int) strtoul(flagValue_s, NULL, 10);
+		} else if(strcmp(flag, "-index") == 0) {
+			*indexFunction = flagValue_s[0];
+			if(*indexFunction != INDEX_MODULO && *indexFunction != INDEX_XOR_FOLD && *indexFunction != INDEX_PRIME && *indexFunction != INDEX_H3 && *indexFunction != INDEX_SKEWED) {
+				printf("Valid index functions are 'M' (modulo), 'X' (XOR-fold), 'P' (prime-modulo), 'H' (H3) or 'S' (skewed-associative)\n");
+				return 27;
+			}
 		} else {
 			printf("Invalid flag given\n");
 			return 7;
 		} //end ifs
 	} //end arg processing for	
 	
+	if(dramConfig->rowHitCycles > dramConfig->rowMissCycles || dramConfig->rowMissCycles > dramConfig->rowConflictCycles) {
+		printf("DRAM row hits must not take longer than row misses, nor row misses longer than row conflicts\n");
+		return 23;
+	}
+	
+	return 0;
+}
+
+//topology file lines (# starts a comment):
+//  core <coreID> <socket>
+//  mem <start hex addr> <end hex addr> <home socket>
+//  interleave <bytes>
+//  latency <localmiss|remotemiss|localinval|remoteinval|localc2c|remotec2c> <cycles>
+void freeTopology(Topology *t) {
+	free(t->coreSockets);
+	free(t->ranges);
+	t->coreSockets = NULL;
+	t->ranges = NULL;
+	t->numSockets = 0;
+}
+
+int loadTopology(Topology *t, char *fileName, int numCyclesPerMiss) {
+	FILE *file;
+	char line[256], name[32];
+	unsigned int start, end, value;
+	int core, socket, lineNum = 0;
+	
+	if(!(file = fopen(fileName, "r"))) {
+		printf("Failed to open topology file\n");
+		return 15;
+	}
+	
+	t->numSockets = 1;
+	t->coreSockets = calloc(NUM_CORES, sizeof(int));
+	t->ranges = NULL;
+	t->numRanges = 0;
+	t->interleaveBytes = DEFAULT_INTERLEAVE_BYTES;
+	t->localMissCycles = numCyclesPerMiss;
+	t->remoteMissCycles = 2 * numCyclesPerMiss;
+	t->localInvalCycles = DEFAULT_LOCAL_INVAL_CYCLES;
+	t->remoteInvalCycles = DEFAULT_REMOTE_INVAL_CYCLES;
+	t->localC2CCycles = DEFAULT_LOCAL_C2C_CYCLES;
+	t->remoteC2CCycles = DEFAULT_REMOTE_C2C_CYCLES;
+	
+	while(fgets(line, sizeof(line), file)) {
+		lineNum++;
+		if(sscanf(line, "%31s", name) != 1 || name[0] == '#') continue;
+		
+		if(sscanf(line, "core %d %d", &core, &socket) == 2 && socket >= 0) {
+			if(core < 0 || core >= NUM_CORES) {
+				printf("Core ID %d on line %d of topology file is out of range (%d cores simulated)\n", core, lineNum, NUM_CORES);
+				fclose(file);
+				freeTopology(t);
+				return 16;
+			}
+			t->coreSockets[core] = socket;
+			if(socket >= t->numSockets) t->numSockets = socket + 1;
+		} else if(sscanf(line, "mem %x %x %d", &start, &end, &socket) == 3 && start <= end && socket >= 0) {
+			t->ranges = realloc(t->ranges, sizeof(MemRange) * (t->numRanges + 1));
+			t->ranges[t->numRanges].start = start;
+			t->ranges[t->numRanges].end = end;
+			t->ranges[t->numRanges].node = socket;
+			t->numRanges++;
+			if(socket >= t->numSockets) t->numSockets = socket + 1;
+		} else if(sscanf(line, "interleave %u", &value) == 1 && value > 0) {
+			t->interleaveBytes = value;
+		} else if(sscanf(line, "latency %31s %u", name, &value) == 2) {
+			if(strcmp(name, "localmiss") == 0) t->localMissCycles = value;
+			else if(strcmp(name, "remotemiss") == 0) t->remoteMissCycles = value;
+			else if(strcmp(name, "localinval") == 0) t->localInvalCycles = value;
+			else if(strcmp(name, "remoteinval") == 0) t->remoteInvalCycles = value;
+			else if(strcmp(name, "localc2c") == 0) t->localC2CCycles = value;
+			else if(strcmp(name, "remotec2c") == 0) t->remoteC2CCycles = value;
+			else {
+				printf("Invalid latency name on line %d of topology file\n", lineNum);
+				fclose(file);
+				freeTopology(t);
+				return 16;
+			}
+		} else {
+			printf("Invalid line %d in topology file\n", lineNum);
+			fclose(file);
+			freeTopology(t);
+			return 16;
+		}
+	}
+	
+	fclose(file);
 	return 0;
 }
 
-void initCache(Cache *c, unsigned int coreID, unsigned int blockSize, unsigned int numDataWords, unsigned int numCyclesPerMiss, unsigned int setAssociativity, char writePolicy) {
+//allocate a single fully-associative set (victim cache, TLB, ...)
+void initFullyAssociativeSet(Set *s, unsigned int numEntries) {
+	Entry *e;
+	
+	s->entries = malloc(sizeof(Entry) * numEntries);
+	s->numEntries = numEntries;
+	s->numEntriesInUse = 0;
+	s->setID = -1;
+	for(int j = 0; j != numEntries; j++) {
+		e = s->entries+j;
+		e->state = INVALID;
+		e->tag = e->valid = e->dirty = e->LRUCounter = e->address = 0;
+		e->entryID = j;
+	}
+}
+
+void initWriteBuffer(WriteBuffer *wb, unsigned int numEntries) {
+	wb->numEntries = numEntries;
+	wb->numEntriesInUse = wb->head = wb->nextDrainCycle = 0;
+	wb->numInserts = wb->numCoalesced = wb->numDrains = wb->numFullBlockDrains = 0;
+	wb->numStalls = wb->numStallCycles = wb->maxOccupancy = 0;
+	wb->occupancySum = 0;
+	wb->blocks = malloc(sizeof(unsigned int) * numEntries);
+	wb->wordMasks = malloc(sizeof(unsigned int) * numEntries);
+	wb->writebacks = malloc(sizeof(char) * numEntries);
+}
+
+//H3: the hash of x XORs one random row per set bit of x; the rows for each byte of x are combined ahead of time
+void initH3Tables(unsigned int *tables, unsigned int numTables, unsigned int mask) {
+	unsigned int x = H3_SEED, rows[32], *t;
+	int bit;
+	
+	for(int i = 0; i != numTables; i++) {
+		for(int j = 0; j != 32; j++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			rows[j] = x & mask;
+		}
+		for(int byte = 0; byte != 4; byte++) {
+			t = tables + i * H3_TABLE_SIZE + byte * 256;
+			t[0] = 0;
+			for(unsigned int v = 1; v != 256; v++) {
+				for(bit = 0; !(v & (1u << bit)); bit++);
+				t[v] = t[v & (v - 1)] ^ rows[byte * 8 + bit];
+			}
+		}
+	}
+}
+
+void initIndexFunction(Cache *c, char indexFunction) {
+	unsigned int numTables = indexFunction == INDEX_SKEWED ? c->numEntriesPerSet : 1;
+	
+	c->indexFunction = indexFunction;
+	c->indexPrime = c->numSets;
+	if(indexFunction == INDEX_PRIME) {
+		while(c->indexPrime > 2 && !isPrime(c->indexPrime)) c->indexPrime--;
+	}
+	
+	c->h3Tables = NULL;
+	if(indexFunction == INDEX_H3 || indexFunction == INDEX_SKEWED) {
+		c->h3Tables = malloc(sizeof(unsigned int) * numTables * H3_TABLE_SIZE);
+		initH3Tables(c->h3Tables, numTables, c->numSets - 1);
+	}
+	c->replaceWay = 0;
+}
+
+void initCache(Cache *c, unsigned int coreID, unsigned int blockSize, unsigned int numDataWords, unsigned int numCyclesPerMiss, unsigned int setAssociativity, char writePolicy, char writeAllocPolicy, unsigned int writeBufferSize, unsigned int writeCombineSize, unsigned int victimCacheSize, char victimCachePolicy, char indexFunction) {
 	c->cacheID = coreID;
 	c->writePolicy = writePolicy;
+	c->writeAllocPolicy = writeAllocPolicy;
 	c->blockSize = blockSize;		//blocksize in numWords					//TODO
 	c->numDataWords = numDataWords;
 	c->numCyclesPerMiss = numCyclesPerMiss;									
@@ -250,6 +953,15 @@ void initCache(Cache *c, unsigned int coreID, unsigned int blockSize, unsigned i
 	c->numWriteHits = c->numCycles = c->numInstructions = c->numBlocksInvalidated = 0;
 	c->numWriteBacksDueToAccessNeed = c->numWriteBacksDueToReadMiss = 0;
 	c->NumWritesToCacheDueToWriteOp = c->NumWritesBacksDueToWriteThruPolicy = 0;
+	c->numWritesAroundCache = 0;
+	c->numVictimHits = c->numVictimSwaps = c->numVictimEvictions = c->numVictimWriteBacks = c->numVictimInvalidations = 0;
+	c->socketID = 0;
+	c->numLocalMisses = c->numRemoteMisses = c->numLocalInvalidations = c->numRemoteInvalidations = 0;
+	c->numLocalTransfers = c->numRemoteTransfers = c->numNumaCycles = 0;
+	c->numWriteAroundMisses = 0;
+	
+	initWriteBuffer(&c->writeBuffer, writeBufferSize);
+	initWriteBuffer(&c->writeCombineBuffer, writeCombineSize);
 			
 	c->entryOffsetLength = (unsigned int) log2(c->numEntriesPerSet);		//TODO
 	c->byteOffsetLength = c->offsetLength - c->entryOffsetLength;			//TODO
@@ -261,6 +973,10 @@ void initCache(Cache *c, unsigned int coreID, unsigned int blockSize, unsigned i
 	
 	//+ (if write back, dirty bits)
 	if(writePolicy == WRITE_BACK) c->numOverheadBits += NUM_BITS_PER_DIRTY * c->numEntries; 
+	
+	//+ (prime-modulo and skewed tags also hold the set index bits the hash does not give back)
+	if(indexFunction == INDEX_PRIME) c->numOverheadBits += c->numEntries;
+	if(indexFunction == INDEX_SKEWED) c->numOverheadBits += c->indexLength * c->numEntries;
 		
 	c->numOverheadBytes = c->numOverheadBits / 32; //32 bits per byte
 	
@@ -283,19 +999,48 @@ void initCache(Cache *c, unsigned int coreID, unsigned int blockSize, unsigned i
 			// e->dataBlock = malloc(sizeof(uint8_t) * blockSize); //uint8_t is guaranteed 8 bits (1 byte)			
 			e->state = INVALID;
 			e->tag = 0;
+			e->address = 0;
 			e->valid = 0;
 			e->dirty = 0;
+			e->LRUCounter = 0;
 			e->entryID = j;
 		}	
 	}
 	
+	/*** allocate the victim/miss cache as a single fully-associative set ***/
+	
+	c->victimCachePolicy = victimCachePolicy;
+	initFullyAssociativeSet(&c->victimCache, victimCacheSize);
+	
+	initIndexFunction(c, indexFunction);
 }
 
-void initMulticoreCache(MulticoreCache *mcc, int blockSize, int numDataWords, int numCyclesPerMiss, int setAssociativity, char writePolicy) {	
+void initPageTable(PageTable *pt) {
+	pt->capacity = 1024;
+	pt->numPages = 0;
+	pt->vpns = malloc(sizeof(unsigned int) * pt->capacity);
+	pt->pfns = malloc(sizeof(unsigned int) * pt->capacity);
+	pt->used = calloc(pt->capacity, sizeof(char));
+}
+
+void initTlbs(Cache *c, TlbConfig *tlbConfig) {
+	c->numTlbHits = c->numTlb2Hits = c->numPageWalks = c->numPageWalkSteps = c->numPageWalkCacheHits = c->numTlbCycles = 0;
+	initFullyAssociativeSet(&c->tlb, tlbConfig->numEntries);
+	initFullyAssociativeSet(&c->tlb2, tlbConfig->numEntries ? tlbConfig->numL2Entries : 0);
+	initFullyAssociativeSet(&c->pageWalkCache, tlbConfig->numEntries ? tlbConfig->numWalkCacheEntries : 0);
+}
+
+void initMulticoreCache(MulticoreCache *mcc, int blockSize, int numDataWords, int numCyclesPerMiss, int setAssociativity, char writePolicy, char writeAllocPolicy, int writeBufferSize, int writeCombineSize, int victimCacheSize, char victimCachePolicy, char indexFunction, Topology *topology, TlbConfig *tlbConfig) {	
 	mcc->caches = malloc(sizeof(Cache) * NUM_CORES);
+	mcc->topology = *topology;
+	mcc->numAccesses = 0;
+	mcc->tlbConfig = *tlbConfig;
+	initPageTable(&mcc->pageTable);
 	
 	for(int i = 0; i != NUM_CORES; i++) {
-		initCache(mcc->caches+i, i /*i is coreID*/, blockSize, numDataWords, numCyclesPerMiss, setAssociativity, writePolicy);
+		initCache(mcc->caches+i, i /*i is coreID*/, blockSize, numDataWords, numCyclesPerMiss, setAssociativity, writePolicy, writeAllocPolicy, writeBufferSize, writeCombineSize, victimCacheSize, victimCachePolicy, indexFunction);
+		if(topology->numSockets) mcc->caches[i].socketID = topology->coreSockets[i];
+		initTlbs(mcc->caches+i, tlbConfig);
 	}
 	
 	printCacheInit(mcc->caches);	
@@ -308,6 +1053,18 @@ void freeCache(Cache *c) {
 	}
 		
 	free(c->sets);	//then free all set objects
+	
+	free(c->writeBuffer.blocks);
+	free(c->writeBuffer.wordMasks);
+	free(c->writeBuffer.writebacks);
+	free(c->writeCombineBuffer.blocks);
+	free(c->writeCombineBuffer.wordMasks);
+	free(c->writeCombineBuffer.writebacks);
+	free(c->victimCache.entries);
+	free(c->tlb.entries);
+	free(c->tlb2.entries);
+	free(c->pageWalkCache.entries);
+	free(c->h3Tables);
 }
 
 void freeMCC(MulticoreCache *mcc) {
@@ -316,12 +1073,17 @@ void freeMCC(MulticoreCache *mcc) {
 	}
 	
 	free(mcc->caches);
+	freeTopology(&mcc->topology);
+	free(mcc->pageTable.vpns);
+	free(mcc->pageTable.pfns);
+	free(mcc->pageTable.used);
 }
 
 Entry* getLeastRecentlyUsedEntry(Set *s, int *entryID) {
 	assert(s->numEntries == s->numEntriesInUse);
 	
 	Entry* lru = s->entries, *e;
+	*entryID = 0;
 	for(int i = 0; i != s->numEntriesInUse; i++) {
 		e = s->entries+i;
 		if(lru->LRUCounter < e->LRUCounter) {
@@ -347,6 +1109,10 @@ Entry* getEntry(Set *s, int entryID) {
 	return (s->entries+entryID);
 }
 
+unsigned int getCoreCycle(Cache *c) {
+	return c->numInstructions * NUM_CYCLES_PER_HIT + c->numCycles;
+}
+
 Set* getSet(Cache *c, int setID) {
 	return (c->sets+setID);
 }
@@ -355,7 +1121,7 @@ int matchingEntryExists(Set *s, int newTag) {
 	Entry *e;
 	for(int i = 0; i != s->numEntries; i++) {
 		e = s->entries+i;
-		if(e->tag == newTag) {
+		if(e->valid && e->tag == newTag) {
 			return 1;
 		}
 	}
@@ -367,7 +1133,7 @@ Entry *matchingEntry(Set *s, int newTag, int *entryID) {
 	Entry *e;
 	for(int i = 0; i != s->numEntries; i++) {
 		e = s->entries+i;
-		if(e->tag == newTag) {
+		if(e->valid && e->tag == newTag) {
 			*entryID = i;
 			return e;
 		}
@@ -392,96 +1158,1107 @@ Entry *getUnusedEntry(Set *s, int *entryID) {
 	return NULL; //in case I change logic
 }
 
-/****************** functions for handling different cases of reads and writes ******************/
+/****************** binary coherence event log ******************/
 
-void handleReadHit(Cache *c, Entry* e) {
-	if(debug) printf("  -READ HIT!\n");
-	c->numHits++;
-	c->numReadHits++;	
+void *eventLogWriter(void *arg) {
+	EventLog *log = arg;
+	CoherenceEvent *buffer;
+	unsigned int numEvents;
+	
+	pthread_mutex_lock(&log->lock);
+	while(1) {
+		while(!log->pending && !log->done) pthread_cond_wait(&log->cond, &log->lock);
+		if(!log->pending) break;	//done and nothing left to write
+		
+		buffer = log->pending;
+		numEvents = log->numPending;
+		pthread_mutex_unlock(&log->lock);
+		fwrite(buffer, sizeof(CoherenceEvent), numEvents, log->file);
+		pthread_mutex_lock(&log->lock);
+		
+		log->pending = NULL;
+		pthread_cond_broadcast(&log->cond);
+	}
+	pthread_mutex_unlock(&log->lock);
+	
+	return NULL;
 }
 
-void handleReadMiss(Cache *c, Entry *e) {		
-	if(debug) printf("  -READ MISS!\n");
-	//TODO: read data block from memory, store in this entry
-	c->numCycles += c->numCyclesPerMiss; 
-	c->numMisses++;
-	c->numWritesToCache++;
-	c->numWritesToCacheDueToReadMiss++;
-	c->numReadMisses++;	
+int openEventLog(EventLog *log, char *fileName) {
+	EventLogHeader header;
+	
+	if(!(log->file = fopen(fileName, "wb"))) {
+		printf("Failed to open event log file\n");
+		return 17;
+	}
+	
+	memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+	header.eventSize = sizeof(CoherenceEvent);
+	header.numCores = NUM_CORES;
+	fwrite(&header, sizeof(header), 1, log->file);
+	
+	log->buffers[0] = malloc(sizeof(CoherenceEvent) * EVENT_LOG_BUFFER_EVENTS);
+	log->buffers[1] = malloc(sizeof(CoherenceEvent) * EVENT_LOG_BUFFER_EVENTS);
+	log->fillBuffer = 0;
+	log->numFilled = log->numPending = 0;
+	log->pending = NULL;
+	log->done = 0;
+	log->accessIndex = log->numEvents = 0;
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->cond, NULL);
+	pthread_create(&log->writer, NULL, eventLogWriter, log);
+	
+	return 0;
 }
 
-void handleWriteHit(Cache *c, Entry* e) {	
-	if(debug) printf("  -WRITE HIT!\n");
-	c->numHits++;
-	c->numWriteHits++;
-	e->dirty = 1; 	
+//hand the filled buffer to the writer thread (waiting for it to finish the previous one) and start filling the other
+void flushEventLog(EventLog *log) {
+	pthread_mutex_lock(&log->lock);
+	while(log->pending) pthread_cond_wait(&log->cond, &log->lock);
+	log->pending = log->buffers[log->fillBuffer];
+	log->numPending = log->numFilled;
+	pthread_cond_broadcast(&log->cond);
+	pthread_mutex_unlock(&log->lock);
+	
+	log->fillBuffer ^= 1;
+	log->numFilled = 0;
 }
 
-void handleWriteMiss(Cache *c, Entry *e) {
-	if(debug) printf("  -WRITE MISS!\n");
-	c->numCycles += c->numCyclesPerMiss; 
-	c->numMisses++;
-	c->numWriteMisses++;
+void closeEventLog(EventLog *log) {
+	if(!log->file) return;
+	
+	if(log->numFilled) flushEventLog(log);
+	pthread_mutex_lock(&log->lock);
+	log->done = 1;
+	pthread_cond_broadcast(&log->cond);
+	pthread_mutex_unlock(&log->lock);
+	pthread_join(log->writer, NULL);
+	
+	fclose(log->file);
+	free(log->buffers[0]);
+	free(log->buffers[1]);
+	pthread_mutex_destroy(&log->lock);
+	pthread_cond_destroy(&log->cond);
+	log->file = NULL;
 }
 
-int handleRead(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
-	Cache *otherCache;
-	Set *otherSet; 		//used for checking corresponding set in other caches
-	Entry *otherEntry;  //used for checking corresponding entry in otherSet
-	int entryID, setID = s->setID, modifiedBlockFound = 0;
-	c->numReads++;
+void logEvent(char type, Cache *c, int setID, int way, unsigned int tag, char oldState, char newState) {
+	CoherenceEvent *ev;
 	
-	Entry *e;
+	if(!eventLog.file) return;
 	
-	/*** check whether we read hit or read miss, and handle accordingly ***/
+	ev = eventLog.buffers[eventLog.fillBuffer] + eventLog.numFilled;
+	ev->accessIndex = eventLog.accessIndex;
+	ev->tag = tag;
+	ev->set = setID;
+	ev->way = way;
+	ev->core = c->cacheID;
+	ev->type = type;
+	ev->oldState = oldState;
+	ev->newState = newState;
+	ev->reserved = 0;
+	eventLog.numEvents++;
 	
-	//check for matching entry
-	if(matchingEntryExists(s, newTag)) {
-		e = matchingEntry(s, newTag, &entryID);
-		//(debug) printf("  -block with matching tag and valid data found in set!\n", entryID);
-		handleReadHit(c, e);
-	} else if(s->numEntriesInUse == s->numEntries) { //if no matching entry, check if set is full
-		e = getLeastRecentlyUsedEntry(s, &entryID);
-		handleReadMiss(c, e);
-		if(debug) printf("  -set is full, selecting least recently used block to evict (index %d of entries array) after handling coherency...\n", entryID);
-	} else { //no matching and set is not full, get first unused entry
-		e = getUnusedEntry(s, &entryID);
-		s->numEntriesInUse++;
-		handleReadMiss(c, e);
-		if(debug) printf("  -empty entry in set, will insert at block %d of entries array after handling coherency...\n", entryID);
-	}		
+	if(++eventLog.numFilled == EVENT_LOG_BUFFER_EVENTS) flushEventLog(&eventLog);
+}
+
+//victim/miss cache entries are logged under the set and tag they had in the cache
+void logVictimEvent(char type, Cache *c, unsigned int victimTag, char oldState, char newState) {
+	logEvent(type, c, victimTag & (c->numSets - 1), EV_VICTIM_WAY, victimTag >> c->indexLength, oldState, newState);
+}
+
+/****************** NUMA topology ******************/
+
+int getHomeSocket(Topology *t, unsigned int byteAddress) {
+	for(int i = 0; i != t->numRanges; i++) {
+		if(byteAddress >= t->ranges[i].start && byteAddress <= t->ranges[i].end) {
+			return t->ranges[i].node;
+		}
+	}
 	
+	return (byteAddress / t->interleaveBytes) % t->numSockets;
+}
+
+//block read from memory at its home socket
+void recordNumaMiss(MulticoreCache *mcc, Cache *c, unsigned int byteAddress) {
+	Topology *t = &mcc->topology;
+	if(!t->numSockets) return;
 	
-	/*** check the current state of the block we are reading, and handle accordingly ***/
+	if(getHomeSocket(t, byteAddress) == c->socketID) {
+		c->numLocalMisses++;
+		c->numNumaCycles += t->localMissCycles;
+	} else {
+		if(debug) printf("    -Block's home memory is on a remote socket...\n");
+		c->numRemoteMisses++;
+		c->numNumaCycles += t->remoteMissCycles;
+	}
+}
+
+//block supplied to cache c by otherCache
+void recordNumaTransfer(MulticoreCache *mcc, Cache *c, Cache *otherCache) {
+	Topology *t = &mcc->topology;
+	if(!t->numSockets) return;
 	
-	switch(e->state) {
-		case 'I':
-			if(debug) printf("  -Reading an INVALID block, first check all corresponding blocks for MODIFIED state before reading from memory:\n");
-			//if invalid on read, we "must verify that the line is not in the "M" state in any other cache" (wikipedia)
-			for(int i = 0; i != NUM_CORES; i++) {
-				otherCache = mcc->caches+i;
-				if(otherCache == c) continue; 				//skip the current cache
-				otherSet = getSet(otherCache, setID);			//get corresponding set
-				otherEntry = getEntry(otherSet, entryID);   //get corresponding entry
-				
-				//if there is a matching modified entry, write that entry to memory
-				//also copy it to the current entry, and then invalide the other entry
-				if(otherEntry->state == MODIFIED) {
-					if(debug) printf("    -CORRESPONDING MODIFIED BLOCK FOUND IN CACHE ID %d! Copying block from that cache to current cache #%d, then invalidating and evicting block in that cache...\n", otherCache->cacheID, c->cacheID);
-					otherCache->numWritesToMem++;
-					otherCache->numBlocksInvalidated++;
-					otherEntry->state = INVALID; 
-					otherSet->numEntriesInUse--;
-					otherEntry->valid = otherEntry->dirty = otherEntry->tag = otherEntry->LRUCounter = 0;
-					modifiedBlockFound = 1;
-				}
-			}
-			
-			if(!modifiedBlockFound) {
-				if(debug) printf("    -No corresponding modified block, so reading from memory store (instead of other cache) to this cache...\n", otherCache->cacheID, c->cacheID);
-			}
-			break;
-		case 'M':
+	if(otherCache->socketID == c->socketID) {
+		c->numLocalTransfers++;
+		c->numNumaCycles += t->localC2CCycles;
+	} else {
+		c->numRemoteTransfers++;
+		c->numNumaCycles += t->remoteC2CCycles;
+	}
+}
+
+//cache c invalidated a block in otherCache
+void recordNumaInvalidation(MulticoreCache *mcc, Cache *c, Cache *otherCache) {
+	Topology *t = &mcc->topology;
+	if(!t->numSockets) return;
+	
+	if(otherCache->socketID == c->socketID) {
+		c->numLocalInvalidations++;
+		c->numNumaCycles += t->localInvalCycles;
+	} else {
+		c->numRemoteInvalidations++;
+		c->numNumaCycles += t->remoteInvalCycles;
+	}
+}
+
+/****************** DRAM main memory ******************/
+
+void initDram(Dram *d, DramConfig *config, unsigned int blockBytes) {
+	d->config = *config;
+	d->blockBytes = blockBytes;
+	d->rowBlocks = blockBytes < DRAM_ROW_BYTES ? DRAM_ROW_BYTES / blockBytes : 1;
+	d->burstCycles = (blockBytes + DRAM_BYTES_PER_BUS_CYCLE - 1) / DRAM_BYTES_PER_BUS_CYCLE;
+	d->banks = calloc(config->numChannels * config->numRanks * config->numBanks, sizeof(DramBank));
+	d->busReadyCycles = calloc(config->numChannels, sizeof(unsigned int));
+	d->queue = malloc(DRAM_QUEUE_ENTRIES * sizeof(DramRequest));
+	d->numQueued = d->clock = 0;
+	d->firstArrival = 0xffffffff;
+}
+
+void freeDram(Dram *d) {
+	free(d->banks);
+	free(d->busReadyCycles);
+	free(d->queue);
+}
+
+//consecutive rows of blocks are spread across channels first, then banks, then ranks
+void mapDramAddress(Dram *d, unsigned int byteAddress, DramRequest *r) {
+	unsigned int banksPerChannel = d->config.numRanks * d->config.numBanks;
+	unsigned int n = byteAddress / d->blockBytes / d->rowBlocks;
+	
+	r->channel = n % d->config.numChannels;
+	n /= d->config.numChannels;
+	r->bank = r->channel * banksPerChannel + n % banksPerChannel;
+	r->row = n / banksPerChannel;
+}
+
+//FR-FCFS: the oldest request to an open row, otherwise the oldest request, among those arrived by cycle limit
+int pickDramRequest(Dram *d, unsigned int limit) {
+	int oldest = -1, oldestHit = -1;
+	DramRequest *r;
+	DramBank *b;
+	
+	for(int i = 0; i != d->numQueued; i++) {
+		r = d->queue+i;
+		if(r->arrival > limit) continue;
+		b = d->banks + r->bank;
+		if(oldest < 0 || r->arrival < d->queue[oldest].arrival) oldest = i;
+		if(b->rowOpen && b->openRow == r->row && (oldestHit < 0 || r->arrival < d->queue[oldestHit].arrival)) oldestHit = i;
+	}
+	
+	return oldestHit >= 0 ? oldestHit : oldest;
+}
+
+//issue queued request i to its bank and return the cycle its data transfer completes
+unsigned int serviceDramRequest(Dram *d, int i) {
+	DramRequest r = d->queue[i];
+	DramBank *b = d->banks + r.bank;
+	unsigned int start = r.arrival > b->readyCycle ? r.arrival : b->readyCycle;
+	unsigned int latency, done;
+	
+	if(b->rowOpen && b->openRow == r.row) {
+		latency = d->config.rowHitCycles;
+		d->numRowHits++;
+	} else if(!b->rowOpen) {
+		latency = d->config.rowMissCycles;
+		d->numRowMisses++;
+	} else {
+		if(debug) printf("    -DRAM row conflict in bank %u, closing row %u to open row %u...\n", r.bank, b->openRow, r.row);
+		latency = d->config.rowConflictCycles;
+		d->numRowConflicts++;
+	}
+	
+	//the block then needs the channel's data bus for one burst
+	done = start + latency;
+	if(done < d->busReadyCycles[r.channel] + d->burstCycles) done = d->busReadyCycles[r.channel] + d->burstCycles;
+	d->busReadyCycles[r.channel] = done;
+	
+	if(d->config.pagePolicy == OPEN_PAGE) {
+		//row stays open; another column access can follow one burst behind this one
+		b->rowOpen = 1;
+		b->openRow = r.row;
+		b->readyCycle = start + latency - d->config.rowHitCycles + d->burstCycles;
+	} else {
+		//bank precharges right after the access
+		b->rowOpen = 0;
+		b->readyCycle = done + d->config.rowConflictCycles - d->config.rowMissCycles;
+	}
+	
+	if(r.isWrite) d->numWrites++;
+	else d->numReads++;
+	d->queueDelaySum += start - r.arrival;
+	d->busBusyCycles += d->burstCycles;
+	if(done > d->lastDone) d->lastDone = done;
+	
+	memmove(d->queue+i, d->queue+i+1, (d->numQueued - i - 1) * sizeof(DramRequest));
+	d->numQueued--;
+	
+	return done;
+}
+
+void enqueueDramRequest(Dram *d, unsigned int byteAddress, unsigned int arrival, int isWrite) {
+	DramRequest *r;
+	
+	//queue full, so the scheduler issues a request to make room
+	if(d->numQueued == DRAM_QUEUE_ENTRIES) serviceDramRequest(d, pickDramRequest(d, 0xffffffff));
+	
+	r = d->queue + d->numQueued++;
+	mapDramAddress(d, byteAddress, r);
+	r->arrival = arrival;
+	r->isWrite = isWrite;
+	if(arrival < d->firstArrival) d->firstArrival = arrival;
+	if(d->numQueued > d->maxQueued) d->maxQueued = d->numQueued;
+}
+
+//cycle on the controller's clock at which a request from cache c arrives; a core that is behind the others
+//cannot send requests into the controller's past, so it catches up to the latest cycle any core has reached
+unsigned int getDramArrival(Dram *d, Cache *c) {
+	if(getCoreCycle(c) > d->clock) d->clock = getCoreCycle(c);
+	return d->clock;
+}
+
+//block fetched from memory by cache c; the core waits until its data arrives
+void recordDramRead(Cache *c, unsigned int byteAddress) {
+	Dram *d = &dram;
+	unsigned int arrival, latency;
+	int i, isRead;
+	
+	if(!d->config.pagePolicy) return;
+	
+	c->numCycles -= c->numCyclesPerMiss;	//DRAM latency replaces the flat miss penalty handleRead/WriteMiss charged
+	arrival = getDramArrival(d, c);
+	enqueueDramRequest(d, byteAddress, arrival, 0);
+	
+	//reads never stay queued, so the first read the scheduler issues is this one
+	do {
+		i = pickDramRequest(d, arrival);
+		isRead = !d->queue[i].isWrite;
+		latency = serviceDramRequest(d, i) - arrival;
+	} while(!isRead);
+	
+	if(debug) printf("    -Block fetched from DRAM in %u cycles...\n", latency);
+	c->numCycles += latency;
+	c->numDramCycles += latency;
+	c->numDramReads++;
+	d->readLatencySum += latency;
+}
+
+//block written to memory by cache c; the core does not wait for writes
+void recordDramWrite(Cache *c, unsigned int byteAddress) {
+	if(!dram.config.pagePolicy) return;
+	enqueueDramRequest(&dram, byteAddress, getDramArrival(&dram, c), 1);
+}
+
+//issue the writes still queued at the end of the trace
+void drainDram(Dram *d) {
+	while(d->numQueued) serviceDramRequest(d, pickDramRequest(d, 0xffffffff));
+}
+
+/****************** set index functions ******************/
+
+//XOR the tag into the set index bits, indexLength bits at a time
+unsigned int xorFold(Cache *c, unsigned int tag) {
+	unsigned int h = 0;
+	
+	if(c->numSets == 1) return 0;
+	for(; tag; tag >>= c->indexLength) h ^= tag;
+	
+	return h & (c->numSets - 1);
+}
+
+unsigned int h3Hash(unsigned int *t, unsigned int x) {
+	return t[x & 0xff] ^ t[256 + ((x >> 8) & 0xff)] ^ t[512 + ((x >> 16) & 0xff)] ^ t[768 + (x >> 24)];
+}
+
+//set a block (key = tag and modulo set index bits) may occupy in way of a skewed cache
+unsigned int getSkewedSetID(Cache *c, unsigned int key, int way) {
+	return (key & (c->numSets - 1)) ^ h3Hash(c->h3Tables + way * H3_TABLE_SIZE, key >> c->indexLength);
+}
+
+//each way of a skewed cache has its own hash; returns the set holding the block, or else the candidate set
+//whose entry in that way is unused or has been idle longest, which a miss then replaces
+unsigned int getSkewedSet(Cache *c, unsigned int key) {
+	unsigned int setID, victimSetID = 0;
+	Entry *e, *victim = NULL;
+	
+	for(int way = 0; way != c->numEntriesPerSet; way++) {
+		setID = getSkewedSetID(c, key, way);
+		e = c->sets[setID].entries + way;
+		if(e->valid && e->tag == key) return setID;
+		if(!victim || (victim->valid && (!e->valid || e->LRUCounter > victim->LRUCounter))) {
+			victim = e;
+			victimSetID = setID;
+			c->replaceWay = way;
+		}
+	}
+	
+	return victimSetID;
+}
+
+//set of the block with the given tag and modulo set index; XOR-fold and H3 leave the tag as is (the index bits
+//can be recovered from it), prime-modulo keeps the quotient and skewed caches the whole key as the tag
+unsigned int hashSetIndex(Cache *c, unsigned int *tag, unsigned int index) {
+	unsigned int key = (*tag << c->indexLength) | index;
+	
+	if(c->indexFunction == INDEX_XOR_FOLD) return index ^ xorFold(c, *tag);
+	if(c->indexFunction == INDEX_H3) return index ^ h3Hash(c->h3Tables, *tag);
+	if(c->indexFunction == INDEX_PRIME) {
+		*tag = key / c->indexPrime;
+		return key % c->indexPrime;
+	}
+	*tag = key;
+	return getSkewedSet(c, key);
+}
+
+//inverse of hashSetIndex: the tag and modulo set index bits of the block in entry (setID, tag)
+unsigned int getEntryKey(Cache *c, int setID, unsigned int tag) {
+	if(c->indexFunction == INDEX_SKEWED) return tag;
+	if(c->indexFunction == INDEX_PRIME) return tag * c->indexPrime + setID;
+	if(c->indexFunction == INDEX_XOR_FOLD) setID ^= xorFold(c, tag);
+	else if(c->indexFunction == INDEX_H3) setID ^= h3Hash(c->h3Tables, tag);
+	
+	return (tag << c->indexLength) | (unsigned int) setID;
+}
+
+/****************** trace reduction ******************/
+
+unsigned int getBlockAddress(Cache *c, unsigned int byteAddress) {
+	return byteAddress & ~(c->numBytesPerBlock - 1);
+}
+
+int openReducedTrace(ReducedTrace *rt, char *fileName) {
+	if(!(rt->file = fopen(fileName, "w+b"))) {	//read back by checkReducedTrace
+		printf("Failed to open reduced trace file\n");
+		return 20;
+	}
+	
+	memcpy(rt->header.magic, REDUCED_TRACE_MAGIC, sizeof(rt->header.magic));
+	rt->header.recordSize = sizeof(ReducedRecord);
+	rt->header.numCores = NUM_CORES;
+	rt->header.blockBytes = 0;
+	rt->header.reserved = 0;
+	rt->header.numAccesses = rt->header.numRecords = 0;
+	fwrite(&rt->header, sizeof(rt->header), 1, rt->file);	//rewritten with the final counts on close
+	
+	return 0;
+}
+
+void writeReducedRecord(Cache *c, unsigned int byteAddress, char type) {
+	ReducedRecord r;
+	
+	r.address = getBlockAddress(c, byteAddress);
+	r.core = c->cacheID;
+	r.type = type;
+	r.reserved = 0;
+	fwrite(&r, sizeof(r), 1, reducedTrace.file);
+	reducedTrace.header.numRecords++;
+}
+
+//a miss or upgrade leaving cache c for the access at byteAddress
+void recordReducedAccess(Cache *c, unsigned int byteAddress, char type) {
+	if(reducedTrace.file) writeReducedRecord(c, byteAddress, type);
+}
+
+//data actually leaving cache c for memory, seen by the reduced trace and the DRAM model
+void sendMemWrite(Cache *c, unsigned int byteAddress, char type) {
+	recordDramWrite(c, byteAddress);
+	
+	if(reducedTrace.file) writeReducedRecord(c, byteAddress, type);
+}
+
+//a write to memory that is both counted in the statistics and sent to memory; the original model also counts
+//writes to mem that carry no data (clean invalidations, upgrades, stores to dirty blocks), which only bump numWritesToMem
+void recordMemWrite(Cache *c, unsigned int byteAddress, char type) {
+	c->numWritesToMem++;
+	sendMemWrite(c, byteAddress, type);
+}
+
+//read the finished trace back from disk and check it against the full simulation: each core must have one fetch per miss
+//that was neither served by its victim/miss cache nor written around the cache, and with -dram there must be one
+//write to memory per write the memory controller serviced; returns the number of failed checks
+int checkReducedTrace(ReducedTrace *rt, MulticoreCache *mcc, unsigned int *numFetches, unsigned int *numUpgrades, unsigned int *numWrites) {
+	ReducedRecord r;
+	Cache *c;
+	uint64_t numRecords = 0;
+	unsigned int expected, totalWrites = 0;
+	int numFailed = 0;
+	
+	fseek(rt->file, sizeof(rt->header), SEEK_SET);
+	while(fread(&r, sizeof(r), 1, rt->file) == 1) {
+		numRecords++;
+		if(r.core >= NUM_CORES || r.address & (mcc->caches->numBytesPerBlock - 1)) {
+			printf("Reduced trace check failed: record %llu has core %u and address 0x%x\n", (unsigned long long) numRecords, r.core, r.address);
+			numFailed++;
+			continue;
+		}
+		if(r.type == RED_READ || r.type == RED_WRITE) numFetches[r.core]++;
+		else if(r.type == RED_UPGRADE) numUpgrades[r.core]++;
+		else numWrites[r.core]++;
+	}
+	
+	if(numRecords != rt->header.numRecords) {
+		printf("Reduced trace check failed: %llu records read back, %llu written\n", (unsigned long long) numRecords, (unsigned long long) rt->header.numRecords);
+		numFailed++;
+	}
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		c = mcc->caches+i;
+		expected = c->numMisses - c->numVictimHits - c->numWriteAroundMisses;
+		if(numFetches[i] != expected) {
+			printf("Reduced trace check failed: core %d has %u fetches, but fetched %u blocks in the full simulation\n", i, numFetches[i], expected);
+			numFailed++;
+		}
+		totalWrites += numWrites[i];
+	}
+	
+	if(dram.config.pagePolicy && totalWrites != dram.numWrites) {
+		printf("Reduced trace check failed: %u writes to memory, but the DRAM model serviced %u\n", totalWrites, dram.numWrites);
+		numFailed++;
+	}
+	
+	return numFailed;
+}
+
+//finish the reduced trace, check it and report how much smaller it is
+void closeReducedTrace(ReducedTrace *rt, MulticoreCache *mcc) {
+	unsigned int *numFetches, *numUpgrades, *numWrites, totalFetches = 0, totalUpgrades = 0, totalWrites = 0;
+	int numFailed;
+	
+	if(!rt->file) return;
+	
+	rt->header.numAccesses = mcc->numAccesses;
+	rt->header.blockBytes = mcc->caches->numBytesPerBlock;
+	fseek(rt->file, 0, SEEK_SET);
+	fwrite(&rt->header, sizeof(rt->header), 1, rt->file);
+	
+	numFetches = calloc(NUM_CORES * 3, sizeof(unsigned int));
+	numUpgrades = numFetches + NUM_CORES;
+	numWrites = numUpgrades + NUM_CORES;
+	numFailed = checkReducedTrace(rt, mcc, numFetches, numUpgrades, numWrites);
+	fclose(rt->file);
+	rt->file = NULL;
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		totalFetches += numFetches[i];
+		totalUpgrades += numUpgrades[i];
+		totalWrites += numWrites[i];
+	}
+	free(numFetches);
+	
+	printf("Trace reduction: %llu accesses reduced to %llu records (reduction factor %f)\n", (unsigned long long) rt->header.numAccesses, (unsigned long long) rt->header.numRecords,
+		rt->header.numRecords ? (double) rt->header.numAccesses / rt->header.numRecords : 0.0);
+	printf("Reduced trace records: %u fetches, %u upgrades, %u writes to memory\n", totalFetches, totalUpgrades, totalWrites);
+	printf("Reduced trace check against full simulation: %s\n\n", numFailed ? "FAILED" : "passed");
+}
+
+/****************** write buffer and write-combining buffer ******************/
+
+void countWriteToMem(Cache *c, unsigned int byteAddress) {
+	recordMemWrite(c, byteAddress, RED_WRITE_THRU);
+	if(c->writePolicy == WRITE_THRU) c->NumWritesBacksDueToWriteThruPolicy++;
+	else c->numWritesAroundCache++;
+}
+
+unsigned int getFullWordMask(Cache *c) {
+	return c->blockSize >= 32 ? 0xffffffff : (1u << c->blockSize) - 1;
+}
+
+void drainOldestBufferedWrite(Cache *c, WriteBuffer *wb) {
+	unsigned int byteAddress = wb->blocks[wb->head] << c->offsetLength;
+	char writeback = wb->writebacks[wb->head];
+	
+	if(debug) printf("    -Draining block 0x%x from write buffer of cache #%d to memory...\n", wb->blocks[wb->head], c->cacheID);
+	if(wb->wordMasks[wb->head] == getFullWordMask(c)) wb->numFullBlockDrains++;
+	wb->head = (wb->head + 1) % wb->numEntries;
+	wb->numEntriesInUse--;
+	wb->numDrains++;
+	
+	//a write back was already counted when the block was dirtied, so it only goes out to memory
+	if(writeback) sendMemWrite(c, byteAddress, RED_WRITEBACK);
+	else countWriteToMem(c, byteAddress);
+}
+
+//memory accepts one buffered block every numCyclesPerMiss cycles, in the background
+void retireBufferedWrites(Cache *c, WriteBuffer *wb) {
+	while(wb->numEntriesInUse && wb->nextDrainCycle <= getCoreCycle(c)) {
+		drainOldestBufferedWrite(c, wb);
+		wb->nextDrainCycle += c->numCyclesPerMiss;
+	}
+}
+
+//buffer the words in wordMask of a block; writeback is 1 for a dirty block evicted from the cache rather than a store
+void bufferWrite(Cache *c, WriteBuffer *wb, unsigned int blockNumber, unsigned int wordMask, char writeback) {
+	unsigned int slot, stallCycles;
+	
+	retireBufferedWrites(c, wb);
+	
+	//coalesce with a pending store to the same block
+	for(int i = 0; i != wb->numEntriesInUse; i++) {
+		slot = (wb->head + i) % wb->numEntries;
+		if(wb->blocks[slot] == blockNumber) {
+			if(debug) printf("    -Coalescing store with block 0x%x already in write buffer...\n", blockNumber);
+			wb->wordMasks[slot] |= wordMask;
+			wb->writebacks[slot] &= writeback;
+			wb->numCoalesced++;
+			return;
+		}
+	}
+	
+	//buffer full, so the core stalls until the oldest entry has been written to memory
+	if(wb->numEntriesInUse == wb->numEntries) {
+		stallCycles = wb->nextDrainCycle - getCoreCycle(c);
+		if(debug) printf("    -Write buffer full, stalling %u cycles...\n", stallCycles);
+		wb->numStalls++;
+		wb->numStallCycles += stallCycles;
+		c->numCycles += stallCycles;
+		drainOldestBufferedWrite(c, wb);
+		wb->nextDrainCycle += c->numCyclesPerMiss;
+	}
+	
+	if(wb->numEntriesInUse == 0) wb->nextDrainCycle = getCoreCycle(c) + c->numCyclesPerMiss;
+	
+	slot = (wb->head + wb->numEntriesInUse) % wb->numEntries;
+	wb->blocks[slot] = blockNumber;
+	wb->wordMasks[slot] = wordMask;
+	wb->writebacks[slot] = writeback;
+	wb->numEntriesInUse++;
+	wb->numInserts++;
+	if(wb->numEntriesInUse > wb->maxOccupancy) wb->maxOccupancy = wb->numEntriesInUse;
+}
+
+void flushWriteBuffer(Cache *c, WriteBuffer *wb) {
+	while(wb->numEntriesInUse) drainOldestBufferedWrite(c, wb);
+}
+
+//send a store to memory, through the write-combining buffer (streaming stores) or write buffer if enabled
+void writeToMem(Cache *c, unsigned int byteAddress, int streaming) {
+	unsigned int blockNumber = byteAddress >> c->offsetLength;
+	unsigned int wordMask = 1u << ((byteAddress / NUM_BYTES_PER_WORD) % c->blockSize % 32);
+	
+	if(streaming && c->writeCombineBuffer.numEntries) {
+		bufferWrite(c, &c->writeCombineBuffer, blockNumber, wordMask, 0);
+	} else if(c->writeBuffer.numEntries) {
+		bufferWrite(c, &c->writeBuffer, blockNumber, wordMask, 0);
+	} else {
+		countWriteToMem(c, byteAddress);
+	}
+}
+
+//a dirty block leaving cache c (or its victim cache) goes to memory through the write buffer if enabled; it was
+//already counted in numWritesToMem when it was dirtied
+void writeBackBlock(Cache *c, unsigned int address) {
+	if(c->writeBuffer.numEntries) bufferWrite(c, &c->writeBuffer, address >> c->offsetLength, getFullWordMask(c), 1);
+	else sendMemWrite(c, address, RED_WRITEBACK);
+}
+
+//a dirty block replaced on a miss is written back, unless the victim cache took it
+void writeBackEvicted(Cache *c, int setID, int entryID, Entry *evicted) {
+	if(c->writePolicy != WRITE_BACK || !evicted->valid || !evicted->dirty) return;
+	if(c->victimCache.numEntries && c->victimCachePolicy == VICTIM_CACHE) return;
+	
+	if(debug) printf("    -Writing back dirty block 0x%x replaced in cache #%d...\n", evicted->address, c->cacheID);
+	logEvent(EV_WRITEBACK, c, setID, entryID, evicted->tag, evicted->state, INVALID);
+	writeBackBlock(c, evicted->address);
+}
+
+//invalidate any copies of a block in other caches (used when a store does not allocate a local entry)
+void invalidateOtherCopies(MulticoreCache *mcc, Cache *c, int setID, int tag) {
+	Cache *otherCache;
+	Set *otherSet;
+	Entry *otherEntry;
+	int otherSetID;
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		PROF_COUNT_SNOOP();
+		otherCache = mcc->caches+i;
+		if(otherCache == c) continue;
+		for(int j = 0; j != otherCache->numEntriesPerSet; j++) {
+			otherSetID = c->indexFunction == INDEX_SKEWED ? getSkewedSetID(otherCache, tag, j) : setID; //skewed ways each have their own set
+			otherSet = getSet(otherCache, otherSetID);
+			otherEntry = getEntry(otherSet, j);
+			if(!otherEntry->valid || otherEntry->tag != tag) continue;
+			
+			if(debug) printf("    -Matching block found in cache ID %d in state %c! Invalidating and evicting...\n", otherCache->cacheID, otherEntry->state);
+			if(otherEntry->state == MODIFIED) {
+				recordMemWrite(otherCache, otherEntry->address, RED_WRITEBACK);
+				logEvent(EV_WRITEBACK, otherCache, otherSetID, j, otherEntry->tag, MODIFIED, INVALID);
+			}
+			logEvent(EV_INVALIDATION, otherCache, otherSetID, j, otherEntry->tag, otherEntry->state, INVALID);
+			otherCache->numBlocksInvalidated++;
+			recordNumaInvalidation(mcc, c, otherCache);
+			otherEntry->state = INVALID;
+			otherSet->numEntriesInUse--;
+			otherEntry->valid = otherEntry->dirty = otherEntry->tag = otherEntry->LRUCounter = 0;
+		}
+	}
+}
+
+//charge cache c's NUMA costs for the other copies of a block it is about to read or write, matched by tag like invalidateOtherCopies
+//(the MSI snoop only compares entries at the same position); returns the number of modified copies, which supply the block
+//only the NUMA and DRAM models use the result, so without either there is nothing to scan
+int snoopNumaCopies(MulticoreCache *mcc, Cache *c, int setID, int tag, char mode) {
+	Cache *otherCache;
+	Entry *otherEntry;
+	int otherSetID, numSupplied = 0;
+	
+	if(!mcc->topology.numSockets && !dram.config.pagePolicy) return 0;
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		PROF_COUNT_SNOOP();
+		otherCache = mcc->caches+i;
+		if(otherCache == c) continue;
+		for(int j = 0; j != otherCache->numEntriesPerSet; j++) {
+			otherSetID = c->indexFunction == INDEX_SKEWED ? getSkewedSetID(otherCache, tag, j) : setID;
+			otherEntry = getEntry(getSet(otherCache, otherSetID), j);
+			if(!otherEntry->valid || otherEntry->tag != tag) continue;
+			
+			if(otherEntry->state == MODIFIED) {
+				recordNumaTransfer(mcc, c, otherCache);
+				numSupplied++;
+			} else if(mode == WRITE_OP) {
+				recordNumaInvalidation(mcc, c, otherCache);
+			}
+		}
+	}
+	
+	return numSupplied;
+}
+
+/****************** TLBs, page walks and address translation ******************/
+
+Entry *findValidEntry(Set *s, unsigned int tag) {
+	Entry *e;
+	for(int i = 0; i != s->numEntries; i++) {
+		e = s->entries+i;
+		if(e->valid && e->tag == tag) {
+			return e;
+		}
+	}
+	
+	return NULL;
+}
+
+//insert tag into a fully-associative set, replacing the least recently used entry if full
+void insertEntry(Set *s, unsigned int tag) {
+	Entry *e;
+	int entryID;
+	
+	if(s->numEntriesInUse != s->numEntries) {
+		e = getUnusedEntry(s, &entryID);
+		s->numEntriesInUse++;
+	} else {
+		e = getLeastRecentlyUsedEntry(s, &entryID);
+	}
+	
+	e->tag = tag;
+	e->valid = 1;
+	updateLRUs(s, e);
+}
+
+//look tag up in a fully-associative set, updating LRU on a hit
+int lookupEntry(Set *s, unsigned int tag) {
+	Entry *e = findValidEntry(s, tag);
+	if(e) updateLRUs(s, e);
+	return e != NULL;
+}
+
+//return the synthetic physical frame of a virtual page, allocating frames in first-touch order
+unsigned int getPhysicalFrame(PageTable *pt, unsigned int vpn) {
+	unsigned int slot = (vpn * 2654435761u) & (pt->capacity - 1);
+	
+	while(pt->used[slot]) {
+		if(pt->vpns[slot] == vpn) return pt->pfns[slot];
+		slot = (slot + 1) & (pt->capacity - 1);
+	}
+	
+	//grow to keep the table at most half full
+	if(2 * (pt->numPages + 1) > pt->capacity) {
+		PageTable old = *pt;
+		pt->capacity *= 2;
+		pt->numPages = 0;
+		pt->vpns = malloc(sizeof(unsigned int) * pt->capacity);
+		pt->pfns = malloc(sizeof(unsigned int) * pt->capacity);
+		pt->used = calloc(pt->capacity, sizeof(char));
+		for(unsigned int i = 0; i != old.capacity; i++) {
+			if(!old.used[i]) continue;
+			slot = (old.vpns[i] * 2654435761u) & (pt->capacity - 1);
+			while(pt->used[slot]) slot = (slot + 1) & (pt->capacity - 1);
+			pt->used[slot] = 1;
+			pt->vpns[slot] = old.vpns[i];
+			pt->pfns[slot] = old.pfns[i];
+			pt->numPages++;
+		}
+		free(old.vpns);
+		free(old.pfns);
+		free(old.used);
+		return getPhysicalFrame(pt, vpn);
+	}
+	
+	pt->used[slot] = 1;
+	pt->vpns[slot] = vpn;
+	pt->pfns[slot] = pt->numPages++;
+	return pt->pfns[slot];
+}
+
+//walk the radix page table for vpn, skipping the upper levels found in the page walk cache; return the cycles taken
+unsigned int walkPageTable(Cache *c, unsigned int vpn, unsigned int pageShift) {
+	unsigned int numLevels = pageShift == 12 ? 4 : pageShift == 21 ? 3 : 2;
+	unsigned int numSteps = numLevels, level;
+	
+	c->numPageWalks++;
+	
+	//find the deepest upper-level (non-leaf) entry in the page walk cache, tagged by its level i from the root and the VA bits it covers
+	for(int i = numLevels - 2; i >= 0 && c->pageWalkCache.numEntries; i--) {
+		level = numLevels - 1 - i;
+		if(lookupEntry(&c->pageWalkCache, ((unsigned int) i << 28) | (vpn >> (NUM_BITS_PER_PAGE_LEVEL * level)))) {
+			c->numPageWalkCacheHits++;
+			numSteps = level;
+			break;
+		}
+	}
+	
+	for(int i = 0; i != numLevels - 1 && c->pageWalkCache.numEntries; i++) {
+		unsigned int tag = ((unsigned int) i << 28) | (vpn >> (NUM_BITS_PER_PAGE_LEVEL * (numLevels - 1 - i)));
+		if(!findValidEntry(&c->pageWalkCache, tag)) insertEntry(&c->pageWalkCache, tag);
+	}
+	
+	if(debug) printf("  -TLB MISS! Walking %u page table levels...\n", numSteps);
+	c->numPageWalkSteps += numSteps;
+	return numSteps * NUM_CYCLES_PER_WALK_STEP;
+}
+
+//translate a virtual address through the core's TLBs; return the address the cache should be indexed with
+unsigned int translateAddress(MulticoreCache *mcc, Cache *c, unsigned int byteAddress) {
+	TlbConfig *t = &mcc->tlbConfig;
+	unsigned int vpn = byteAddress >> t->pageShift, cycles = 0;
+	
+	if(lookupEntry(&c->tlb, vpn)) {
+		c->numTlbHits++;
+	} else {
+		if(c->tlb2.numEntries && lookupEntry(&c->tlb2, vpn)) {
+			c->numTlb2Hits++;
+			cycles = NUM_CYCLES_PER_TLB2_HIT;
+		} else {
+			cycles = walkPageTable(c, vpn, t->pageShift);
+			if(c->tlb2.numEntries) insertEntry(&c->tlb2, vpn);
+		}
+		insertEntry(&c->tlb, vpn);
+	}
+	
+	c->numTlbCycles += cycles;
+	c->numCycles += cycles;
+	
+	if(!t->physical) return byteAddress;
+	return (getPhysicalFrame(&mcc->pageTable, vpn) << t->pageShift) | (byteAddress & ((1u << t->pageShift) - 1));
+}
+
+/****************** victim cache and miss cache ******************/
+
+//victim/miss cache entries hold blocks from any set, so their tag also includes the set index
+unsigned int getVictimTag(Cache *c, Set *s, int tag) {
+	return getEntryKey(c, s->setID, tag);
+}
+
+Entry *matchingVictimEntry(Set *vc, unsigned int victimTag) {
+	Entry *v;
+	for(int i = 0; i != vc->numEntries; i++) {
+		v = vc->entries+i;
+		if(v->valid && v->tag == victimTag) {
+			return v;
+		}
+	}
+	
+	return NULL;
+}
+
+void invalidateVictimEntry(Set *vc, Entry *v) {
+	v->state = INVALID;
+	vc->numEntriesInUse--;
+	v->valid = v->dirty = v->tag = v->LRUCounter = 0;
+}
+
+//get a free victim/miss cache entry, replacing (and writing back if dirty) the least recently used one if full
+Entry *allocateVictimEntry(Cache *c) {
+	Set *vc = &c->victimCache;
+	Entry *v;
+	int entryID;
+	
+	if(vc->numEntriesInUse != vc->numEntries) {
+		v = getUnusedEntry(vc, &entryID);
+		vc->numEntriesInUse++;
+		return v;
+	}
+	
+	v = getLeastRecentlyUsedEntry(vc, &entryID);
+	if(c->writePolicy == WRITE_BACK && v->dirty) {
+		if(debug) printf("    -Replacing dirty block in victim cache of cache #%d, writing it to memory...\n", c->cacheID);
+		writeBackBlock(c, v->address);
+		c->numVictimWriteBacks++;
+		logVictimEvent(EV_WRITEBACK, c, v->tag, v->state, INVALID);
+	}
+	if(v->valid) logVictimEvent(EV_EVICTION, c, v->tag, v->state, INVALID);
+	
+	return v;
+}
+
+//move the block being evicted from entry e of set s into the victim cache
+void captureVictim(Cache *c, Set *s, Entry *e) {
+	Entry *v = allocateVictimEntry(c);
+	
+	if(debug) printf("    -Moving evicted block into victim cache...\n");
+	v->tag = getVictimTag(c, s, e->tag);
+	v->address = e->address;
+	v->state = e->state;
+	v->dirty = e->dirty;
+	v->valid = 1;
+	updateLRUs(&c->victimCache, v);
+	c->numVictimEvictions++;
+	
+	e->state = INVALID;
+	e->valid = e->dirty = 0;
+}
+
+//on a miss in set s, try to supply the block from the victim/miss cache instead of memory, placing it in entry e
+//return true (1) if the block was supplied; false (0) if it must come from another cache or memory
+int fillFromVictimCache(Cache *c, Set *s, Entry *e, int newTag, unsigned int byteAddress, char mode) {
+	Set *vc = &c->victimCache;
+	Entry *v, old;
+	unsigned int victimTag = getVictimTag(c, s, newTag);
+	
+	if(!vc->numEntries) return 0;
+	v = matchingVictimEntry(vc, victimTag);
+	
+	//miss cache: keep a clean copy of every block read from memory, supply it again on a later miss
+	if(c->victimCachePolicy == MISS_CACHE) {
+		if(v) {
+			updateLRUs(vc, v);
+			e->state = v->state;
+			e->dirty = 0;
+			e->valid = 1;
+			c->numVictimHits++;
+			return 1;
+		}
+		
+		if(mode == READ_OP) {
+			v = allocateVictimEntry(c);
+			v->tag = victimTag;
+			v->address = getBlockAddress(c, byteAddress);
+			v->state = SHARED;
+			v->dirty = 0;
+			v->valid = 1;
+			updateLRUs(vc, v);
+		}
+		return 0;
+	}
+	
+	//victim cache: catch the evicted block on a miss, swap the two blocks on a hit
+	if(!v) {
+		if(e->valid) captureVictim(c, s, e);
+		return 0;
+	}
+	
+	c->numVictimHits++;
+	old = *e;
+	e->state = v->state;
+	e->dirty = v->dirty;
+	e->valid = 1;
+	e->address = v->address;
+	if(old.valid) {
+		if(debug) printf("    -Swapping evicted block into victim cache...\n");
+		v->tag = getVictimTag(c, s, old.tag);
+		v->address = old.address;
+		v->state = old.state;
+		v->dirty = old.dirty;
+		updateLRUs(vc, v);
+		c->numVictimSwaps++;
+	} else {
+		invalidateVictimEntry(vc, v);
+	}
+	
+	return 1;
+}
+
+//keep the victim/miss caches of other cores coherent with a block this cache is about to read or modify; returns the number of modified copies, which supply the block
+int snoopVictimCaches(MulticoreCache *mcc, Cache *c, unsigned int victimTag, char mode) {
+	Cache *otherCache;
+	Entry *v;
+	int numSupplied = 0;
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		PROF_COUNT_SNOOP();
+		otherCache = mcc->caches+i;
+		if(otherCache == c) continue;
+		v = matchingVictimEntry(&otherCache->victimCache, victimTag);
+		if(!v || (mode == READ_OP && v->state != MODIFIED)) continue;
+		
+		if(debug) printf("    -Matching block found in victim cache of cache ID %d in state %c! Invalidating and evicting...\n", otherCache->cacheID, v->state);
+		if(v->state == MODIFIED) {
+			recordMemWrite(otherCache, v->address, RED_WRITEBACK);
+			logVictimEvent(EV_WRITEBACK, otherCache, victimTag, MODIFIED, INVALID);
+		}
+		logVictimEvent(EV_INVALIDATION, otherCache, victimTag, v->state, INVALID);
+		otherCache->numBlocksInvalidated++;
+		if(v->state == MODIFIED) {
+			recordNumaTransfer(mcc, c, otherCache);
+			numSupplied++;
+		} else {
+			recordNumaInvalidation(mcc, c, otherCache);
+		}
+		otherCache->numVictimInvalidations++;
+		invalidateVictimEntry(&otherCache->victimCache, v);
+	}
+	
+	return numSupplied;
+}
+
+/****************** functions for handling different cases of reads and writes ******************/
+
+void handleReadHit(Cache *c, Entry* e) {
+	if(debug) printf("  -READ HIT!\n");
+	c->numHits++;
+	c->numReadHits++;	
+}
+
+void handleReadMiss(Cache *c, Entry *e) {		
+	if(debug) printf("  -READ MISS!\n");
+	//TODO: read data block from memory, store in this entry
+	c->numCycles += c->numCyclesPerMiss; 
+	c->numMisses++;
+	c->numWritesToCache++;
+	c->numWritesToCacheDueToReadMiss++;
+	c->numReadMisses++;	
+}
+
+void handleVictimHit(Cache *c, Entry *e, char mode) {
+	if(debug) printf("  -%s MISS, but block found in %s!\n", mode == READ_OP ? "READ" : "WRITE", c->victimCachePolicy == VICTIM_CACHE ? "victim cache" : "miss cache");
+	c->numCycles += NUM_CYCLES_PER_VICTIM_HIT;
+	c->numMisses++;
+	if(mode == READ_OP) c->numReadMisses++;
+	else c->numWriteMisses++;
+	c->numWritesToCache++;
+}
+
+void handleWriteHit(Cache *c, Entry* e) {	
+	if(debug) printf("  -WRITE HIT!\n");
+	c->numHits++;
+	c->numWriteHits++;
+	e->dirty = 1; 	
+}
+
+void handleWriteMiss(Cache *c, Entry *e) {
+	if(debug) printf("  -WRITE MISS!\n");
+	c->numCycles += c->numCyclesPerMiss; 
+	c->numMisses++;
+	c->numWriteMisses++;
+}
+
+int handleRead(MulticoreCache *mcc, Cache *c, Set *s, int newTag, unsigned int byteAddress) {
+	Cache *otherCache;
+	Set *otherSet; 		//used for checking corresponding set in other caches
+	Entry *otherEntry;  //used for checking corresponding entry in otherSet
+	int entryID, setID = s->setID, modifiedBlockFound = 0, suppliedLocally = 0, numCopiesSupplied = 0;
+	char oldState;
+	c->numReads++;
+	
+	Entry *e, evicted;
+	
+	/*** check whether we read hit or read miss, and handle accordingly ***/
+	
+	PROF_START(lookupStart);
+	//check for matching entry
+	if(matchingEntryExists(s, newTag)) {
+		e = matchingEntry(s, newTag, &entryID);
+		//(debug) printf("  -block with matching tag and valid data found in set!\n", entryID);
+		handleReadHit(c, e);
+		suppliedLocally = 1;
+	} else if(c->indexFunction == INDEX_SKEWED) { //no matching entry, replace the way picked across the block's candidate sets
+		e = getEntry(s, entryID = c->replaceWay);
+		if(e->valid) logEvent(EV_EVICTION, c, setID, entryID, e->tag, e->state, INVALID);
+		else s->numEntriesInUse++;
+		evicted = *e;
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, READ_OP);
+		if(suppliedLocally) handleVictimHit(c, e, READ_OP);
+		else handleReadMiss(c, e);
+		writeBackEvicted(c, setID, entryID, &evicted);
+		if(debug) printf("  -skewed cache, replacing way %d of set %d after handling coherency...\n", entryID, setID);
+	} else if(s->numEntriesInUse == s->numEntries) { //if no matching entry, check if set is full
+		e = getLeastRecentlyUsedEntry(s, &entryID);
+		if(e->valid) logEvent(EV_EVICTION, c, setID, entryID, e->tag, e->state, INVALID);
+		evicted = *e;
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, READ_OP);
+		if(suppliedLocally) handleVictimHit(c, e, READ_OP);
+		else handleReadMiss(c, e);
+		writeBackEvicted(c, setID, entryID, &evicted);
+		if(debug) printf("  -set is full, selecting least recently used block to evict (index %d of entries array) after handling coherency...\n", entryID);
+	} else { //no matching and set is not full, get first unused entry
+		e = getUnusedEntry(s, &entryID);
+		s->numEntriesInUse++;
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, READ_OP);
+		if(suppliedLocally) handleVictimHit(c, e, READ_OP);
+		else handleReadMiss(c, e);
+		if(debug) printf("  -empty entry in set, will insert at block %d of entries array after handling coherency...\n", entryID);
+	}		
+	PROF_STOP(PROF_LOOKUP, lookupStart);
+	oldState = suppliedLocally ? e->state : INVALID;
+	if(!suppliedLocally) recordReducedAccess(c, byteAddress, RED_READ);
+	
+	
+	/*** check the current state of the block we are reading, and handle accordingly ***/
+	
+	PROF_START(snoopStart);
+	if(!suppliedLocally) numCopiesSupplied = snoopNumaCopies(mcc, c, setID, newTag, READ_OP);
+	switch(e->state) {
+		case 'I':
+			if(debug) printf("  -Reading an INVALID block, first check all corresponding blocks for MODIFIED state before reading from memory:\n");
+			//if invalid on read, we "must verify that the line is not in the "M" state in any other cache" (wikipedia)
+			for(int i = 0; i != NUM_CORES; i++) {
+				PROF_COUNT_SNOOP();
+				otherCache = mcc->caches+i;
+				if(otherCache == c) continue; 				//skip the current cache
+				otherSet = getSet(otherCache, setID);			//get corresponding set
+				otherEntry = getEntry(otherSet, entryID);   //get corresponding entry
+				
+				//if there is a matching modified entry, write that entry to memory
+				//also copy it to the current entry, and then invalide the other entry
+				if(otherEntry->state == MODIFIED) {
+					if(debug) printf("    -CORRESPONDING MODIFIED BLOCK FOUND IN CACHE ID %d! Copying block from that cache to current cache #%d, then invalidating and evicting block in that cache...\n", otherCache->cacheID, c->cacheID);
+					recordMemWrite(otherCache, otherEntry->address, RED_WRITEBACK);
+					otherCache->numBlocksInvalidated++;
+					logEvent(EV_WRITEBACK, otherCache, setID, entryID, otherEntry->tag, MODIFIED, INVALID);
+					logEvent(EV_INVALIDATION, otherCache, setID, entryID, otherEntry->tag, MODIFIED, INVALID);
+					otherEntry->state = INVALID; 
+					otherSet->numEntriesInUse--;
+					otherEntry->valid = otherEntry->dirty = otherEntry->tag = otherEntry->LRUCounter = 0;
+					modifiedBlockFound = 1;
+				}
+			}
+			
+			if(!modifiedBlockFound) {
+				if(debug) printf("    -No corresponding modified block, so reading from memory store (instead of other cache) to this cache...\n", otherCache->cacheID, c->cacheID);
+			}
+			break;
+		case 'M':
 		if(debug) printf("    -Reading from a MODIFIED block, supplying data without reading from memory store...\n");
 		//"When a read request arrives at a cache for a block in the "M" or "S" states, the cache supplies the data."
 		 //nothing else to do, we've already served the data
@@ -492,47 +2269,100 @@ int handleRead(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
 		 //nothing else to do, we've already served the data		
 	}
 	
+	if(!suppliedLocally && c->victimCache.numEntries) numCopiesSupplied += snoopVictimCaches(mcc, c, getVictimTag(c, s, newTag), READ_OP);
+	if(!suppliedLocally && !numCopiesSupplied) {
+		recordNumaMiss(mcc, c, byteAddress);
+		recordDramRead(c, byteAddress);
+	}
+	PROF_STOP(PROF_SNOOP, snoopStart);
+	
 	/*** finally, we reset the current entries LRU counter, set it to valid, and update its tag  ***/
 	
+	PROF_START(lruStart);
 	updateLRUs(s,e); //increment LRU counter for all entries in set except e, which becomes 0
+	PROF_STOP(PROF_LRU, lruStart);
 	e->tag = newTag;
+	e->address = getBlockAddress(c, byteAddress);
 	e->state = SHARED;
+	if(!suppliedLocally) e->dirty = 0;	//fresh copy from memory or another cache; a victim cache hit keeps its dirty bit
 	e->valid = 1;
+	if(oldState != SHARED) logEvent(EV_TRANSITION, c, setID, entryID, newTag, oldState, SHARED);
 }
 
-int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
+int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag, unsigned int byteAddress) {
 	Cache *otherCache;
-	Entry *e = NULL, *otherEntry;  //used for checking corresponding entry in otherSet;
+	Entry *e = NULL, *otherEntry, evicted;  //used for checking corresponding entry in otherSet;
 	Set *otherSet; 		//used for checking corresponding set in other caches
-	int entryID, setID = s->setID, modifiedBlockFound = 0;
+	int entryID, setID = s->setID, modifiedBlockFound = 0, suppliedLocally = 0, ownedModified, numCopiesSupplied = 0;
+	char oldState;
+	unsigned int victimTag = getVictimTag(c, s, newTag);
 	c->numWrites++;
-	c->numWritesToCache++;
-	c->NumWritesToCacheDueToWriteOp++;
 	
 	/*** check whether we write hit or write miss, and handle accordingly ***/
 	
+	PROF_START(lookupStart);
 	//check for matching entry
 	if(matchingEntryExists(s, newTag)) {
 		e = matchingEntry(s, newTag, &entryID);
 		//if(debug) printf("    -block with matching tag and valid bit found in set!\n", entryID);
 		handleWriteHit(c, e);
+		suppliedLocally = 1;
+	} else if(c->writeAllocPolicy == NO_WRITE_ALLOCATE && !matchingVictimEntry(&c->victimCache, victimTag)) { //write miss without allocating, store goes around the cache
+		if(debug) printf("  -WRITE MISS! No-write-allocate policy selected, writing around the cache...\n");
+		c->numMisses++;
+		c->numWriteMisses++;
+		c->numWriteAroundMisses++;
+		PROF_STOP(PROF_LOOKUP, lookupStart);
+		invalidateOtherCopies(mcc, c, setID, newTag);
+		if(c->victimCache.numEntries) snoopVictimCaches(mcc, c, victimTag, WRITE_OP);
+		writeToMem(c, byteAddress, 1);
+		return 1;
+	} else if(c->indexFunction == INDEX_SKEWED) { //no matching entry, replace the way picked across the block's candidate sets
+		e = getEntry(s, entryID = c->replaceWay);
+		if(e->valid) logEvent(EV_EVICTION, c, setID, entryID, e->tag, e->state, INVALID);
+		else s->numEntriesInUse++;
+		evicted = *e;
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, WRITE_OP);
+		if(suppliedLocally) handleVictimHit(c, e, WRITE_OP);
+		else handleWriteMiss(c, e);
+		writeBackEvicted(c, setID, entryID, &evicted);
+		if(debug) printf("  -skewed cache, replacing way %d of set %d after handling coherency...\n", entryID, setID);
 	} else if(s->numEntriesInUse == s->numEntries) { //if no matching entry, check if set is full
 		e = getLeastRecentlyUsedEntry(s, &entryID);
-		handleWriteMiss(c, e);
+		if(e->valid) logEvent(EV_EVICTION, c, setID, entryID, e->tag, e->state, INVALID);
+		evicted = *e;
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, WRITE_OP);
+		if(suppliedLocally) handleVictimHit(c, e, WRITE_OP);
+		else handleWriteMiss(c, e);
+		writeBackEvicted(c, setID, entryID, &evicted);
 		if(debug) printf("  -set is full, selecting least recently used block to evict (index %d of entries array) after handling coherency...\n", entryID);
 	} else { //no matching and set is not full, get first unused entry
 		e = getUnusedEntry(s, &entryID);
-		handleWriteMiss(c, e);
+		suppliedLocally = fillFromVictimCache(c, s, e, newTag, byteAddress, WRITE_OP);
+		if(suppliedLocally) handleVictimHit(c, e, WRITE_OP);
+		else handleWriteMiss(c, e);
 		if(debug) printf("  -empty entry in set, will insert at block %d of entries array after handling coherency...\n", entryID);
 		s->numEntriesInUse++;
 	}
 	
+	PROF_STOP(PROF_LOOKUP, lookupStart);
+	oldState = suppliedLocally ? e->state : INVALID;
+	if(!suppliedLocally) recordReducedAccess(c, byteAddress, RED_WRITE);
+	else if(oldState == SHARED) recordReducedAccess(c, byteAddress, RED_UPGRADE);
+	
+	c->numWritesToCache++;
+	c->NumWritesToCacheDueToWriteOp++;
+	ownedModified = suppliedLocally && e->state == MODIFIED;
+	
+	PROF_START(snoopStart);
+	if(!ownedModified) numCopiesSupplied = snoopNumaCopies(mcc, c, setID, newTag, WRITE_OP);
 	switch(e->state) {
 		case 'I':
 			if(debug) printf("    -Writing to an INVALID block, first notify other caches to evict any corresponding blocks which are modified or shared\n");
 		 //"If the block is in the "I" state, the cache must notify any other caches that might contain the block in the "S" or "M" states that they must evict the block. If the block is in another cache in the "M" state, that cache must either write the data to the backing store or supply it to the requesting cache. If at this point the cache does not yet have the block locally, the block is read from the backing store before being modified in the cache. After the data is modified, the cache block is in the "M" state."
 			//for every corresponding entry, if it is modified, evict it
 			for(int i = 0; i != NUM_CORES; i++) {
+				PROF_COUNT_SNOOP();
 				otherCache = mcc->caches+i;
 				if(otherCache == c) continue;
 				otherSet = getSet(otherCache, setID);			//get corresponding set
@@ -542,8 +2372,10 @@ int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
 				//if there is a matching modified entry, write that entry to memory; also copy it to the current entry, and then invalide the other entry
 				if(otherEntry->state == MODIFIED) {
 					if(debug) printf("      -CORRESPONDING MODIFIED BLOCK FOUND IN CACHE ID %d! Copying that block to current cache #%d (current core mem op), then invalidating and evicting...\n", otherCache->cacheID, c->cacheID);
-					otherCache->numWritesToMem++;
+					recordMemWrite(otherCache, otherEntry->address, RED_WRITEBACK);
 					otherCache->numBlocksInvalidated++;
+					logEvent(EV_WRITEBACK, otherCache, setID, entryID, otherEntry->tag, MODIFIED, INVALID);
+					logEvent(EV_INVALIDATION, otherCache, setID, entryID, otherEntry->tag, MODIFIED, INVALID);
 					otherEntry->state = INVALID; 
 					otherSet->numEntriesInUse--;
 					otherEntry->valid = otherEntry->dirty = otherEntry->tag = otherEntry->LRUCounter = 0;
@@ -565,6 +2397,7 @@ int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
 			//for every corresponding entry, if it is shared, evict it
 			if(debug) printf("    -Writing to a SHARED block, notifying other caches to evict matching SHARED blocks...\n");
 			for(int i = 0; i != NUM_CORES; i++) {
+				PROF_COUNT_SNOOP();
 				otherCache = mcc->caches+i;
 				if(otherCache == c) continue;
 				otherSet = getSet(otherCache, setID);			//get corresponding set
@@ -574,9 +2407,10 @@ int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
 				if(otherEntry->state == SHARED) {
 					if(debug) printf("      -CORRESPONDING SHARED BLOCK FOUND IN CACHE ID %d! Invalidating and evicting...\n",otherCache->cacheID);
 					//if(debug) printf("        -Matching block found in cache %d in SHARED state! Evicting entry from that cache...");
-					otherCache->numWritesToMem++;
+					otherCache->numWritesToMem++;	//block is clean, nothing reaches memory
 					// other->numWriteBacksDueToAccessNeed++;
 					otherCache->numBlocksInvalidated++;
+					logEvent(EV_INVALIDATION, otherCache, setID, entryID, otherEntry->tag, SHARED, INVALID);
 					otherEntry->state = INVALID; 
 					modifiedBlockFound = 1;
 					otherEntry->valid = otherEntry->dirty = otherEntry->tag = otherEntry->LRUCounter = 0;
@@ -588,31 +2422,47 @@ int handleWrite(MulticoreCache *mcc, Cache *c, Set *s, int newTag) {
 			}
 			
 			c->numWriteBacksDueToAccessNeed++;
-			c->numWritesToMem++;
+			c->numWritesToMem++;	//upgrade only, nothing reaches memory
  	}
 	
+	//other victim/miss caches may hold the block too, and our own miss cache copy is about to go stale
+	if(c->victimCache.numEntries) {
+		if(!ownedModified) numCopiesSupplied += snoopVictimCaches(mcc, c, victimTag, WRITE_OP);
+		if(c->victimCachePolicy == MISS_CACHE && (otherEntry = matchingVictimEntry(&c->victimCache, victimTag))) invalidateVictimEntry(&c->victimCache, otherEntry);
+	}
+	if(!suppliedLocally && !numCopiesSupplied) {
+		recordNumaMiss(mcc, c, byteAddress);
+		recordDramRead(c, byteAddress);
+	}
+	PROF_STOP(PROF_SNOOP, snoopStart);
+	
 	/*** write to memory depending on policy selected (do after handling state so we don't prematurely write to a modified block in another cache) ***/
 		
 	if(c->writePolicy == WRITE_THRU) {
 		if(debug) printf("    -Write-thru policy selected, writing new value to memory...\n");
-		c->numWritesToMem++;
-		c->NumWritesBacksDueToWriteThruPolicy++;		
+		writeToMem(c, byteAddress, 0);
 	} //check if need to evict valid & dirty block
 	 else if(c->writePolicy == 'B' && e->valid && e->dirty) { 
 		if(debug) printf("    -Write-back policy selected and dirty block selected, writing old block to memory and evicting from current cache #%d...\n", c->cacheID);
 		c->numWriteBacksDueToReadMiss++;
-		c->numWritesToMem++;
+		c->numWritesToMem++;	//real dirty evictions were written back (and logged) by writeBackEvicted
 	} else {
 		if(debug) printf("    -Write-back policy selected but non-dirty block selected, writing new value to cache but not to memory...\n");
 	}
 	
 	/*** finally, we reset the current entries LRU counter, set it to valid and dirty, and update its tag  ***/
 	
+	PROF_START(lruStart);
 	updateLRUs(s,e); //increment LRU counter for all entries in set except e, which becomes 0
+	PROF_STOP(PROF_LRU, lruStart);
 	e->tag = newTag;
+	e->address = getBlockAddress(c, byteAddress);
 	e->state = MODIFIED;
 	e->dirty = 1;
 	e->valid = 1;	
+	if(oldState != MODIFIED) logEvent(EV_TRANSITION, c, setID, entryID, newTag, oldState, MODIFIED);
+	
+	return 1;
 }
 
 /****************** handle single cache entry ******************/
@@ -626,28 +2476,38 @@ int handleCacheEntry(MulticoreCache *mcc, int coreID, unsigned int byteAddress,
 	int setID, entryID;
 				
 	c->numInstructions++;
+	eventLog.accessIndex = mcc->numAccesses++;
 	
 	/*** make sure we are reading a valid memory operation ***/	
 	if(mode != READ_OP && mode != WRITE_OP)
 		return 0;
+	
+	/*** translate the (virtual) trace address if TLBs are simulated ***/
+	if(mcc->tlbConfig.numEntries) byteAddress = translateAddress(mcc, c, byteAddress);
 		
 	/*** parse address into tag, set index, and offset ***/	
 	tag = (byteAddress >> (ADDRESS_LENGTH - c->tagLength)); 	//get the tagLength MSBs (drop the LSB)
 	
 	blockAddress = byteAddress / c->blockSize; 							//pg 390
 	index = blockAddress % c->numSets; 									//set index; pg 404
+	if(c->indexFunction != INDEX_MODULO) index = hashSetIndex(c, &tag, index);	//spread strides that would share a set
 	//offsetFull = byteAddress % (unsigned int) pow(2, c->offsetLength);	//byte offset
 		
 	/*** fetch the correct set  ***/	
 	s = (c->sets+index); //sweet, sweet pointer arithmetic	
 	
 	if(mode == READ_OP) { //valid read
-		handleRead(mcc, c, s, tag);
+		handleRead(mcc, c, s, tag, byteAddress);
 	} else { 			
-		handleWrite(mcc, c, s, tag);
+		handleWrite(mcc, c, s, tag, byteAddress);
 	} //end mode if
 	
+	c->writeBuffer.occupancySum += c->writeBuffer.numEntriesInUse;
+	c->writeCombineBuffer.occupancySum += c->writeCombineBuffer.numEntriesInUse;
+	
 	if(debug)printf("\n");
+	
+	return 1;
 }
 
 /****************** simulate cache fcn ******************/
@@ -658,33 +2518,250 @@ void calculateFinalValues(MulticoreCache *mcc) {
 		c = mcc->caches+i;
 		c->hitRatio = (double) c->numHits / (double) c->numInstructions;
 		
+		//stores still buffered at the end of the trace are written to memory
+		flushWriteBuffer(c, &c->writeBuffer);
+		flushWriteBuffer(c, &c->writeCombineBuffer);
+		
 		double hitTime = (double) NUM_CYCLES_PER_HIT;
 		double missPenalty = (double) c->numCyclesPerMiss;
 		double missRatio = 1.0 - c->hitRatio; 
-		c->avgMemAccessTime = hitTime + missRatio * missPenalty;
+		double stallCycles = (double) (c->writeBuffer.numStallCycles + c->writeCombineBuffer.numStallCycles);
+		double victimHitRatio = (double) c->numVictimHits / (double) c->numInstructions; //misses served by the victim/miss cache
+		double missCycles = (missRatio - victimHitRatio) * missPenalty;
+		if(mcc->topology.numSockets) missCycles = (double) c->numNumaCycles / (double) c->numInstructions; //misses, invalidations and transfers priced by distance
+		if(dram.config.pagePolicy) {
+			//fetches from memory cost their DRAM latency instead of the flat (or local socket) miss latency
+			if(mcc->topology.numSockets) missCycles -= (double) c->numDramReads * mcc->topology.localMissCycles / (double) c->numInstructions;
+			else missCycles -= (double) c->numDramReads * missPenalty / (double) c->numInstructions;
+			missCycles += (double) c->numDramCycles / (double) c->numInstructions;
+		}
+		c->avgMemAccessTime = hitTime + missCycles + victimHitRatio * NUM_CYCLES_PER_VICTIM_HIT + (stallCycles + c->numTlbCycles) / (double) c->numInstructions;
+	}
+	if(dram.config.pagePolicy) drainDram(&dram);
+}
+
+
+
+/****************** per-core trace merging ******************/
+
+//xorshift64*, so a seed gives the same interleaving on every platform
+unsigned long long nextRandom(TraceMerge *m) {
+	m->randomState ^= m->randomState >> 12;
+	m->randomState ^= m->randomState << 25;
+	m->randomState ^= m->randomState >> 27;
+	return m->randomState * 0x2545F4914F6CDD1DULL;
+}
+
+//per-core trace lines are "[timestamp] address mode"; a timestamp of +N means N instructions after the previous access
+int readTraceStream(TraceStream *ts) {
+	char line[256], first[64], second[64], mode;
+	int n;
+	
+	while(fgets(line, sizeof(line), ts->file)) {
+		n = sscanf(line, "%63s %63s %c", first, second, &mode);
+		if(n == 3) {
+			if(first[0] == '+') ts->timestamp += strtoull(first+1, NULL, 10);
+			else ts->timestamp = strtoull(first, NULL, 10);
+			ts->address = (unsigned int) strtoull(second, NULL, 16);
+			ts->mode = mode;
+		} else if(n == 2) {
+			ts->timestamp = ts->numAccesses;
+			ts->address = (unsigned int) strtoull(first, NULL, 16);
+			ts->mode = second[0];
+		} else {
+			continue; //blank line
+		}
+		ts->numAccesses++;
+		return 1;
+	}
+	
+	return 0;
+}
+
+//round-robin gives each core quantum accesses per turn; random races exponentially distributed delays,
+//so every core with accesses left is equally likely to take the next quantum
+unsigned long long getMergeKey(TraceMerge *m, TraceStream *ts) {
+	int newQuantum = (ts->numAccesses - 1) % m->config.quantum == 0;
+	double u;
+	
+	if(m->config.policy == MERGE_ROUND_ROBIN) return (ts->numAccesses - 1) / m->config.quantum;
+	if(m->config.policy == MERGE_RANDOM) {
+		if(!newQuantum) return ts->key;
+		u = (double) ((nextRandom(m) >> 11) + 1) / 9007199254740992.0;
+		return m->clock + 1 + (unsigned long long) (-log(u) * 1048576.0);
+	}
+	return ts->timestamp;
+}
+
+int streamBefore(TraceStream *a, TraceStream *b) {
+	return a->key < b->key || (a->key == b->key && a->coreID < b->coreID);
+}
+
+void siftDownTraceHeap(TraceMerge *m, int i) {
+	TraceStream *ts = m->heap[i];
+	int child;
+	
+	while((child = 2*i + 1) < m->heapSize) {
+		if(child + 1 < m->heapSize && streamBefore(m->heap[child+1], m->heap[child])) child++;
+		if(!streamBefore(m->heap[child], ts)) break;
+		m->heap[i] = m->heap[child];
+		i = child;
 	}
+	m->heap[i] = ts;
 }
 
+void pushTraceHeap(TraceMerge *m, TraceStream *ts) {
+	int i = m->heapSize++, parent;
+	
+	while(i && streamBefore(ts, m->heap[parent = (i-1) / 2])) {
+		m->heap[i] = m->heap[parent];
+		i = parent;
+	}
+	m->heap[i] = ts;
+}
 
+void closeTraceMerge(TraceMerge *m) {
+	for(int i = 0; i != m->numStreams; i++) {
+		if(m->streams[i].file) fclose(m->streams[i].file);
+	}
+	free(m->streams);
+	free(m->heap);
+}
 
-void simulateCacheFromTraceFile(FILE *file, MulticoreCache* mcc) {
+//open one trace per core, named by pattern with %d replaced by the core ID
+int openTraceMerge(TraceMerge *m, char *pattern, MergeConfig *config) {
+	char name[1024];
+	const char *p = strchr(pattern, '%');
+	TraceStream *ts;
+	
+	if(strchr(p+1, '%') || p[1] != 'd') {
+		printf("Per-core trace name must contain a single %%d for the core ID\n");
+		return 26;
+	}
+	
+	m->config = *config;
+	m->numStreams = NUM_CORES;
+	m->streams = calloc(NUM_CORES, sizeof(TraceStream));
+	m->heap = malloc(NUM_CORES * sizeof(TraceStream*));
+	m->heapSize = 0;
+	m->clock = m->numAccesses = 0;
+	m->randomState = config->seed * 0x9E3779B97F4A7C15ULL + 1;	//never 0
+	
+	for(int i = 0; i != NUM_CORES; i++) {
+		ts = m->streams+i;
+		snprintf(name, sizeof(name), pattern, i);
+		if(!(ts->file = fopen(name, "r"))) {
+			printf("Failed to open file %s\n", name);
+			closeTraceMerge(m);
+			return 2;
+		}
+		ts->coreID = i;
+		if(readTraceStream(ts)) {
+			ts->key = getMergeKey(m, ts);
+			pushTraceHeap(m, ts);
+		}
+	}
+	
+	return 0;
+}
+
+//take the next access in merge order and refill its stream
+int nextMergedAccess(TraceMerge *m, unsigned int *coreID, unsigned int *address, char *mode) {
+	TraceStream *ts;
+	
+	if(!m->heapSize) return 0;
+	
+	ts = m->heap[0];
+	*coreID = ts->coreID;
+	*address = ts->address;
+	*mode = ts->mode;
+	m->clock = ts->key;
+	m->numAccesses++;
+	
+	if(readTraceStream(ts)) ts->key = getMergeKey(m, ts);
+	else m->heap[0] = m->heap[--m->heapSize];
+	if(m->heapSize) siftDownTraceHeap(m, 0);
+	
+	return 1;
+}
+
+/****************** trace simulation ******************/
+
+//return true (1) if file is a reduced trace written with -reduce; otherwise rewind it for reading as text
+int readReducedTraceHeader(FILE *file, ReducedTraceHeader *header) {
+	if(fread(header, sizeof(*header), 1, file) == 1 && memcmp(header->magic, REDUCED_TRACE_MAGIC, sizeof(header->magic)) == 0 && header->recordSize == sizeof(ReducedRecord)) {
+		return 1;
+	}
+	
+	rewind(file);
+	return 0;
+}
+
+//a reduced trace can only be replayed with the number of cores and block size it was recorded with
+int checkReducedTraceHeader(FILE *file, unsigned int blockBytes) {
+	ReducedTraceHeader header;
+	int code = 0;
+	
+	if(readReducedTraceHeader(file, &header) && (header.numCores != NUM_CORES || header.blockBytes != blockBytes)) {
+		printf("Reduced trace was recorded with %u cores and %u-byte blocks, but %u cores and %u-byte blocks are simulated\n", header.numCores, header.blockBytes, NUM_CORES, blockBytes);
+		code = 28;
+	}
+	
+	rewind(file);
+	return code;
+}
+
+//simulate from one interleaved (or reduced) trace file, or from per-core traces through merge when file is NULL
+void simulateCacheFromTraceFile(FILE *file, TraceMerge *merge, MulticoreCache* mcc) {
 	Cache *c;
 	unsigned int binAddress, coreID;	
 	char mode;		
+	ReducedTraceHeader header;
+	ReducedRecord record;
+	uint64_t numRecords = 0;
+	
+	//reduced traces are replayed with fetches as reads and upgrades/writes to memory as writes
+	int reduced = file && readReducedTraceHeader(file, &header);
 	
-	printf("\nNow simulating cache from trace file...\n\n");
+	printf("\nNow simulating cache from %s...\n\n", merge ? "per-core trace files" : reduced ? "reduced trace file" : "trace file");
 	
-	while (!feof(file)) {
+	PROF_RUN_START();
+	while (merge ? merge->heapSize != 0 : reduced ? numRecords != header.numRecords : !feof(file)) {
+		PROF_BEGIN_ACCESS();
+		
 		//read the core/cache ID, data address, and mode (R/W)
-		fscanf(file, "%u %x %c\n", &coreID, &binAddress, &mode);		
+		PROF_START(parseStart);
+		if(merge) {
+			nextMergedAccess(merge, &coreID, &binAddress, &mode);
+		} else if(reduced) {
+			if(fread(&record, sizeof(record), 1, file) != 1) {
+				printf("Reduced trace ended after %llu of %llu records\n", (unsigned long long) numRecords, (unsigned long long) header.numRecords);
+				break;
+			}
+			if(record.core >= NUM_CORES) {
+				printf("Reduced trace record %llu has out-of-range core ID %u\n", (unsigned long long) numRecords, record.core);
+				break;
+			}
+			numRecords++;
+			coreID = record.core;
+			binAddress = record.address;
+			mode = record.type == RED_READ ? READ_OP : WRITE_OP;
+		} else {
+			fscanf(file, "%u %x %c\n", &coreID, &binAddress, &mode);		
+		}
+		PROF_STOP(PROF_PARSE, parseStart);
+		
+		PROF_START(entryStart);
 		if(debug) printf("%u %x %c\n", coreID, binAddress, mode);
 		
 		handleCacheEntry(mcc, coreID, binAddress, mode);
+		PROF_STOP(PROF_OTHER, entryStart);
    }
+   PROF_RUN_STOP();
    
    calculateFinalValues(mcc);
 	
-	fclose(file);
+	if(file) fclose(file);
 }
 
 /****************** main ******************/
@@ -692,30 +2769,65 @@ void simulateCacheFromTraceFile(FILE *file, MulticoreCache* mcc) {
 int main(int argc, char** argv) {
 	MulticoreCache mcc;
 	// Cache cache;
-	FILE* file;
+	FILE* file = NULL;
+	char *traceName = argv[argc-1];
+	int merging = strchr(traceName, '%') != NULL;	//per-core traces, e.g. core%d.txt
+	TraceMerge traceMerge;
 	int code, blockSize = 1, totalNumDataWords = 1024, numCyclesPerMiss = 100, setAssociativity = 1; 
-	char writePolicy = 'T';
+	char writePolicy = 'T', writeAllocPolicy = 'A';
+	int writeBufferSize = 0, writeCombineSize = 0, victimCacheSize = 0;
+	char victimCachePolicy = 'V', indexFunction = 'M', *topologyFile = NULL, *eventLogFile = NULL, *reducedTraceFile = NULL;
+	Topology topology = {0};
+	TlbConfig tlbConfig = { 0, 0, 0, 12, 0 };
+	DramConfig dramConfig = { 0, 1, 1, 8, DEFAULT_DRAM_ROW_HIT_CYCLES, DEFAULT_DRAM_ROW_MISS_CYCLES, DEFAULT_DRAM_ROW_CONFLICT_CYCLES };
+	MergeConfig mergeConfig = { MERGE_TIMESTAMP, 1, 0 };
 	
-	//open file
-	if(!(file = fopen(argv[argc-1], "r"))) {
+	//open file (per-core traces are opened once the number of cores is known)
+	if(!merging && !(file = fopen(traceName, "r"))) {
 		printf("Failed to open file\n");
 	 	return 2; 
 	}	
 	
 	/*** process program arguments ***/	
-	if(code = processProgArgs(argv, argc, &blockSize, &totalNumDataWords, &numCyclesPerMiss, &setAssociativity, &writePolicy))
+	if(code = processProgArgs(argv, argc, &blockSize, &totalNumDataWords, &numCyclesPerMiss, &setAssociativity, &writePolicy, &writeAllocPolicy, &writeBufferSize, &writeCombineSize, &victimCacheSize, &victimCachePolicy, &topologyFile, &eventLogFile, &tlbConfig, &reducedTraceFile, &dramConfig, &mergeConfig, &indexFunction))
+		return code;
+	
+	if(file && (code = checkReducedTraceHeader(file, blockSize * NUM_BYTES_PER_WORD)))
+		return code;
+	
+	if(merging && (code = openTraceMerge(&traceMerge, traceName, &mergeConfig)))
+		return code;
+	
+	if(topologyFile && (code = loadTopology(&topology, topologyFile, numCyclesPerMiss)))
+		return code;
+	
+	if(eventLogFile && (code = openEventLog(&eventLog, eventLogFile)))
 		return code;
 	
+	if(reducedTraceFile && (code = openReducedTrace(&reducedTrace, reducedTraceFile)))
+		return code;
+	
+	if(dramConfig.pagePolicy) initDram(&dram, &dramConfig, blockSize * NUM_BYTES_PER_WORD);
+	
 	/*** initiate and simulate cache ***/		
-	initMulticoreCache(&mcc, (unsigned int) blockSize, (unsigned int) totalNumDataWords, (unsigned int) numCyclesPerMiss, (unsigned int) setAssociativity, writePolicy);
+	initMulticoreCache(&mcc, (unsigned int) blockSize, (unsigned int) totalNumDataWords, (unsigned int) numCyclesPerMiss, (unsigned int) setAssociativity, writePolicy, writeAllocPolicy, writeBufferSize, writeCombineSize, victimCacheSize, victimCachePolicy, indexFunction, &topology, &tlbConfig);
 	
-	simulateCacheFromTraceFile(file, &mcc);
+	simulateCacheFromTraceFile(file, merging ? &traceMerge : NULL, &mcc);
+	closeEventLog(&eventLog);
 
 	/*** print cache statistics and free dynamically allocated memory ***/				
 	//if(debug) printCacheInit(mcc.caches);			
 	printCacheStats(&mcc); 
+	if(eventLogFile) printf("Total number of coherence events logged to %s: %llu\n\n", eventLogFile, eventLog.numEvents);
+	if(merging) {
+		printf("Total number of accesses merged from %d per-core traces: %llu\n\n", traceMerge.numStreams, traceMerge.numAccesses);
+		closeTraceMerge(&traceMerge);
+	}
+	closeReducedTrace(&reducedTrace, &mcc);
+	PROF_REPORT();
 		
 	freeMCC(&mcc);
+	if(dramConfig.pagePolicy) freeDram(&dram);
 	
 	return 0;
 }
@@ -0,0 +1,158 @@
+//Reader and query tool for the binary coherence event logs written by cache-sim -log
+//
+//Command-line options (last argument is the log file):
+//    -core #    only show events for core #
+//    -set #     only show events for set #
+//    -tag #     only show events for tag # (hex)
+//    -type K    only show events of type K ('T' transition, 'I' invalidation, 'W' writeback, 'E' eviction)
+//    -from #    only show events at or after access index #
+//    -to #      only show events at or before access index #
+//    -summary 1 print per-core event counts and state transition counts instead of the events
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coherence-log.h"
+
+const int MAX_CORES = 256;
+const char STATES[] = "MSI";
+const char EVENT_TYPES[] = "TIWE";
+
+typedef struct Query {
+	long core, set;
+	long long tag;
+	char type;
+	unsigned long long from, to;
+	int summary;
+} Query;
+
+int processProgArgs(char **argv, int argc, Query *q) {
+	if(argc % 2 != 0) {
+		printf("Must provide an odd amount of arguments\n");
+		return 1;
+	}
+	
+	for(int i = 1; i < (argc-1); i += 2) {
+		char *flag = argv[i];
+		char *flagValue_s = argv[i+1];
+		
+		if(strcmp(flag, "-core") == 0) {
+			q->core = atol(flagValue_s);
+		} else if(strcmp(flag, "-set") == 0) {
+			q->set = atol(flagValue_s);
+		} else if(strcmp(flag, "-tag") == 0) {
+			q->tag = strtoll(flagValue_s, NULL, 16);
+		} else if(strcmp(flag, "-type") == 0) {
+			q->type = flagValue_s[0];
+			if(!q->type || !strchr(EVENT_TYPES, q->type)) {
+				printf("Valid event types are 'T', 'I', 'W' or 'E'\n");
+				return 3;
+			}
+		} else if(strcmp(flag, "-from") == 0) {
+			q->from = strtoull(flagValue_s, NULL, 10);
+		} else if(strcmp(flag, "-to") == 0) {
+			q->to = strtoull(flagValue_s, NULL, 10);
+		} else if(strcmp(flag, "-summary") == 0) {
+			q->summary = atoi(flagValue_s) != 0;
+		} else {
+			printf("Invalid flag given\n");
+			return 4;
+		}
+	}
+	
+	return 0;
+}
+
+int matchesQuery(Query *q, CoherenceEvent *ev) {
+	return (q->core < 0 || ev->core == q->core)
+		&& (q->set < 0 || ev->set == q->set)
+		&& (q->tag < 0 || ev->tag == q->tag)
+		&& (!q->type || ev->type == q->type)
+		&& ev->accessIndex >= q->from && ev->accessIndex <= q->to;
+}
+
+const char *eventName(char type) {
+	switch(type) {
+		case EV_TRANSITION:   return "TRANSITION";
+		case EV_INVALIDATION: return "INVALIDATION";
+		case EV_WRITEBACK:    return "WRITEBACK";
+		case EV_EVICTION:     return "EVICTION";
+	}
+	return "UNKNOWN";
+}
+
+int stateIndex(char state) {
+	char *p = strchr(STATES, state);
+	return p && state ? p - STATES : 2;
+}
+
+//-1 for an unknown type; strchr would match the terminator for type 0
+int typeIndex(char type) {
+	char *p = strchr(EVENT_TYPES, type);
+	return p && type ? p - EVENT_TYPES : -1;
+}
+
+int main(int argc, char **argv) {
+	Query q = { -1, -1, -1, 0, 0, (unsigned long long) -1, 0 };
+	EventLogHeader header;
+	CoherenceEvent events[4096];
+	unsigned long long numMatched = 0, typeCounts[MAX_CORES][4], transitions[3][3];
+	size_t n;
+	FILE *file;
+	int code;
+	
+	if((code = processProgArgs(argv, argc, &q)))
+		return code;
+	
+	if(argc < 2 || !(file = fopen(argv[argc-1], "rb"))) {
+		printf("Failed to open file\n");
+		return 2;
+	}
+	
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) != 0 || header.eventSize != sizeof(CoherenceEvent)) {
+		printf("Not a coherence event log (or written by an incompatible build)\n");
+		fclose(file);
+		return 5;
+	}
+	
+	memset(typeCounts, 0, sizeof(typeCounts));
+	memset(transitions, 0, sizeof(transitions));
+	
+	while((n = fread(events, sizeof(CoherenceEvent), sizeof(events) / sizeof(events[0]), file)) > 0) {
+		for(size_t i = 0; i != n; i++) {
+			CoherenceEvent *ev = events+i;
+			if(!matchesQuery(&q, ev)) continue;
+			numMatched++;
+			
+			if(!q.summary) {
+				printf("%llu core %u set %u way ", (unsigned long long) ev->accessIndex, ev->core, ev->set);
+				if(ev->way == EV_VICTIM_WAY) printf("victim");
+				else printf("%u", ev->way);
+				printf(" tag 0x%x %s %c->%c\n", ev->tag, eventName(ev->type), ev->oldState, ev->newState);
+				continue;
+			}
+			
+			if(ev->core < MAX_CORES && typeIndex(ev->type) >= 0) typeCounts[ev->core][typeIndex(ev->type)]++;
+			if(ev->type == EV_TRANSITION) transitions[stateIndex(ev->oldState)][stateIndex(ev->newState)]++;
+		}
+	}
+	fclose(file);
+	
+	if(q.summary) {
+		printf("Number of cores: %u\n", header.numCores);
+		printf("Total number of matching events: %llu\n", numMatched);
+		for(unsigned int i = 0; i != header.numCores && i != MAX_CORES; i++) {
+			printf("Core %u: %llu transitions, %llu invalidations, %llu writebacks, %llu evictions\n", i, typeCounts[i][0], typeCounts[i][1], typeCounts[i][2], typeCounts[i][3]);
+		}
+		printf("State transitions (old->new):\n");
+		for(int i = 0; i != 3; i++) {
+			for(int j = 0; j != 3; j++) {
+				if(transitions[i][j]) printf("  %c->%c: %llu\n", STATES[i], STATES[j], transitions[i][j]);
+			}
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,39 @@
+//Binary coherence event log format, written by cache-sim (-log flag) and read by coherence-log
+//
+//A log is an EventLogHeader followed by CoherenceEvent records in access order.
+//All fields are in the byte order of the machine that ran the simulation.
+
+#ifndef COHERENCE_LOG_H
+#define COHERENCE_LOG_H
+
+#include <stdint.h>
+
+#define EVENT_LOG_MAGIC "CSIMEVT1"
+
+//event types
+#define EV_TRANSITION   'T'	//state of the accessing cache's entry changed
+#define EV_INVALIDATION 'I'	//block invalidated in another cache
+#define EV_WRITEBACK    'W'	//modified/dirty block written to memory
+#define EV_EVICTION     'E'	//valid block evicted to make room for a new one
+
+#define EV_VICTIM_WAY 0xffff	//way of events on a victim/miss cache entry
+
+typedef struct EventLogHeader {
+	char magic[8];
+	uint32_t eventSize;	//sizeof(CoherenceEvent), to catch mismatched builds
+	uint32_t numCores;
+} EventLogHeader;
+
+typedef struct CoherenceEvent {
+	uint64_t accessIndex;	//0-based line of the trace being simulated
+	uint32_t tag;
+	uint32_t set;
+	uint16_t way;
+	uint8_t core;
+	char type;
+	char oldState;		//MODIFIED, SHARED or INVALID
+	char newState;
+	uint16_t reserved;
+} CoherenceEvent;
+
+#endif